@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+
+namespace game {
+
+// queues work for a fixed set of threads shared by the whole library, so work in flight needs no thread of its own
+void async_post(std::function<void()> work);
+
+// how many threads async work shares.  defaults to the number of hardware threads, and at least 4.
+void async_threads(size_t count);
+
+// runs work on the shared threads, with its result or exception in the future
+template <typename Function>
+auto async_run(Function && work) -> std::future<decltype(work())>
+{
+	auto task = std::make_shared<std::packaged_task<decltype(work())()>>(std::forward<Function>(work));
+	auto result = task->get_future();
+	async_post([task]() { (*task)(); });
+	return result;
+}
+
+// runs work, then passes its ready future to done on the same thread, so no other thread waits on the future.
+// work still holds its thread until it returns, so work that blocks, such as a network transfer, takes a thread the whole time.
+template <typename Function, typename Done>
+void async_run(Function && work, Done && done)
+{
+	using result_type = decltype(work());
+	auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<Function>(work));
+	auto callback = std::make_shared<typename std::decay<Done>::type>(std::forward<Done>(done));
+	async_post([task, callback]() {
+		auto result = task->get_future();
+		(*task)();
+		(*callback)(std::move(result));
+	});
+}
+
+}
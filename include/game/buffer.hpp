@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace game {
+
+// an immutable run of bytes that is shared and sliced without copying.
+// whatever owns the bytes lives until the last buffer referring to them is gone.
+class buffer
+{
+public:
+	using const_iterator = uint8_t const *;
+
+	buffer()
+	: _data(nullptr), _size(0), _vector(nullptr)
+	{ }
+
+	// takes over a vector without copying it
+	buffer(std::vector<uint8_t> && data)
+	{
+		auto owner = std::make_shared<std::vector<uint8_t> const>(std::move(data));
+		_data = owner->data();
+		_size = owner->size();
+		_vector = owner.get();
+		_owner = std::move(owner);
+	}
+
+	explicit buffer(std::vector<uint8_t> const & data)
+	: buffer(std::vector<uint8_t>(data))
+	{ }
+
+	buffer(std::shared_ptr<void const> owner, uint8_t const * data, size_t size)
+	: _owner(std::move(owner)), _data(data), _size(size), _vector(nullptr)
+	{ }
+
+	// maps a file read-only
+	static buffer map(std::string const & filename)
+	{
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::system_error(errno, std::generic_category(), filename);
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			int error = errno;
+			close(fd);
+			throw std::system_error(error, std::generic_category(), filename);
+		}
+		size_t size = info.st_size;
+		if (!size) {
+			close(fd);
+			return {};
+		}
+		void * data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		int error = errno;
+		close(fd);
+		if (data == MAP_FAILED) {
+			throw std::system_error(error, std::generic_category(), filename);
+		}
+		std::shared_ptr<void const> owner(data, [size](void const * data) {
+			munmap(const_cast<void *>(data), size);
+		});
+		return {std::move(owner), static_cast<uint8_t const *>(data), size};
+	}
+
+	uint8_t const * data() const { return _data; }
+	size_t size() const { return _size; }
+	bool empty() const { return !_size; }
+
+	const_iterator begin() const { return _data; }
+	const_iterator end() const { return _data + _size; }
+
+	uint8_t operator[](size_t index) const { return _data[index]; }
+
+	// a buffer sharing this one's bytes from offset, clamped to the end
+	buffer slice(size_t offset, size_t size = ~size_t(0)) const
+	{
+		if (offset > _size) { offset = _size; }
+		if (size > _size - offset) { size = _size - offset; }
+		buffer result(_owner, _data + offset, size);
+		if (offset == 0 && size == _size) {
+			result._vector = _vector;
+		}
+		return result;
+	}
+
+	// the bytes as a vector, for interfaces that need one.  copies only if this buffer is not a whole vector already.
+	std::shared_ptr<std::vector<uint8_t> const> vector() const
+	{
+		if (_vector) {
+			return {_owner, _vector};
+		}
+		return std::make_shared<std::vector<uint8_t> const>(begin(), end());
+	}
+
+	bool operator==(buffer const & other) const
+	{
+		return _size == other._size && (_data == other._data || !_size || !memcmp(_data, other._data, _size));
+	}
+	bool operator!=(buffer const & other) const
+	{
+		return !(*this == other);
+	}
+
+private:
+	std::shared_ptr<void const> _owner;
+	uint8_t const * _data;
+	size_t _size;
+	std::vector<uint8_t> const * _vector; // set when the bytes are exactly the contents of a vector held by _owner
+};
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "identifiers.hpp"
+
+namespace game {
+
+// names of every digest algorithm the digest backend can produce, enabled or not
+std::vector<std::string> digests_available();
+
+// turns an algorithm on or off for subsequent processing
+void digests_enable(std::string const & algorithm, bool enabled = true);
+
+bool digests_enabled(std::string const & algorithm);
+
+// buffers at least this large are hashed with each algorithm on its own thread.  0 disables threading.
+void digests_threaded_size(size_t bytes);
+
+// hashes data incrementally as it arrives, with every enabled algorithm at once
+class digester
+{
+public:
+	digester();
+	digester(digester &&);
+	~digester();
+
+	void update(uint8_t const * data, size_t size);
+	void update(std::vector<uint8_t> const & data) { update(data.data(), data.size()); }
+	void update(buffer const & data) { update(data.data(), data.size()); }
+
+	// bytes passed to update since construction or the last finalize
+	size_t size() const;
+
+	// returns the digests of everything updated so far and starts over
+	identifiers finalize();
+
+private:
+	struct state;
+	std::unique_ptr<state> _state;
+};
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+namespace game {
+
+// where the disk cache backend keeps its files.  an empty path disables it.
+// defaults to $XDG_CACHE_HOME/libgame or ~/.cache/libgame.
+void disk_cache_path(std::string const & path);
+
+std::string disk_cache_path();
+
+// the least recently used objects are removed once the cache holds more than this.  defaults to 1 GiB.
+void disk_cache_size(size_t bytes);
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+
+namespace game {
+
+// EVP digest contexts, kept per thread and reused, so concurrent digests never share one
+
+struct mdctx_destroy
+{
+	void operator()(EVP_MD_CTX * mdctx) { EVP_MD_CTX_destroy(mdctx); }
+};
+using mdctx_ptr = std::unique_ptr<EVP_MD_CTX, mdctx_destroy>;
+
+inline std::vector<mdctx_ptr> & mdctx_pool()
+{
+	static thread_local std::vector<mdctx_ptr> pool;
+	return pool;
+}
+
+inline mdctx_ptr take_mdctx()
+{
+	auto & pool = mdctx_pool();
+	if (pool.empty()) {
+		return mdctx_ptr(EVP_MD_CTX_create());
+	}
+	auto mdctx = std::move(pool.back());
+	pool.pop_back();
+	return mdctx;
+}
+
+inline void put_mdctx_back(mdctx_ptr mdctx)
+{
+	mdctx_pool().push_back(std::move(mdctx));
+}
+
+// the digest backend's implementation of an algorithm named as by digests_available.  it is fetched once,
+// where OpenSSL 3 would otherwise look it up again each time a legacy EVP_sha512_256() and the like is passed.
+EVP_MD const * digest_md(std::string const & algorithm);
+
+// starts a digest, reusing what mdctx already holds when it last ran the same md
+inline void mdctx_init(EVP_MD_CTX * mdctx, EVP_MD const * md)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_DigestInit_ex2(mdctx, md, NULL);
+#else
+	EVP_DigestInit_ex(mdctx, md, NULL);
+#endif
+}
+
+}
@@ -1,27 +1,73 @@
 #pragma once
 
+#include <future>
+#include <stdexcept>
 #include <vector>
 
+#include "buffer.hpp"
 #include "identifiers.hpp"
 
 namespace game {
 
-void storage_process(std::vector<uint8_t> & data, identifiers & what, bool keep_stored = true);
+void storage_process(buffer & data, identifiers & what, bool keep_stored = true);
 
 class storage
 {
 public:
 	enum class process_result {
-		STORED_AND_VERIFIED, // data in vector is correct and is stored reliably elsewhere
-		VERIFIED,  // data in vector is correct with identifiers, no additional storage
+		STORED_AND_VERIFIED, // data in buffer is correct and is stored reliably elsewhere
+		STORED, // data in buffer is correct and was handed to reliable storage elsewhere, but not read back from it
+		VERIFIED,  // data in buffer is correct with identifiers, no additional storage
 		UNPROCESSABLE, // not enough information to process
-		INCONSISTENT // data in vector is wrong or identifiers are wrong
+		INCONSISTENT // data in buffer is wrong or identifiers are wrong
 		// if an unavoidable error is encountered, throw a process_error for now.  means processing cannot be fully completed.
 	};
-	storage();
+	// backends are run stage by stage in this order.  backends sharing a stage run in parallel.
+	enum class stage {
+		DIGEST, // needs only data
+		LOCAL, // kept on this machine, so tried before anything remote
+		STORE // may need identifiers from earlier stages.  skipped for objects already stored.
+	};
+	storage(stage order = stage::DIGEST);
 	~storage();
-	virtual process_result process(std::vector<uint8_t> & data, identifiers & what, bool keep_stored) = 0;
+	virtual process_result process(buffer & data, identifiers & what, bool keep_stored) = 0;
+
+	struct object
+	{
+		buffer * data;
+		identifiers * what;
+	};
+	// backends may override this to share fixed costs across many objects.  by default each is processed in turn.
+	virtual std::vector<process_result> process_batch(std::vector<object> const & objects, bool keep_stored);
+
+	// called on every backend once an object has been processed successfully, with its final identifiers
+	virtual void processed(buffer const & data, identifiers const & what, process_result result);
+
+	stage const order;
+};
+
+// processes many objects in one call.  throws if any of them cannot be processed.
+void storage_process_batch(std::vector<storage::object> const & objects, bool keep_stored = true);
+
+// the same on the library's shared threads (see async.hpp), with any error in the future.
+// data and identifiers are filled in where they are, so they must outlive the future.
+// a backend that transfers over the network holds a shared thread until it is done.
+std::future<void> storage_process_async(buffer & data, identifiers & what, bool keep_stored = true);
+
+std::future<void> storage_process_batch_async(std::vector<storage::object> objects, bool keep_stored = true);
+
+// objects processed recently are kept in memory, and handed back by any of their identifiers without running a backend.
+// the least recently used are dropped once they take more than this.  0 disables keeping them.
+void storage_cache_size(size_t bytes);
+
+struct storage_cache_statistics
+{
+	size_t hits;
+	size_t misses;
+	size_t size; // bytes held
+	size_t objects;
 };
+storage_cache_statistics storage_cache_stats();
 
 class process_error : public std::runtime_error
 {
@@ -1,38 +1,143 @@
 #pragma once
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "buffer.hpp"
 #include "identifiers.hpp"
 
 namespace game{
 
-using offset_t = double;
+// positions along every span are exact integers
+using offset_t = uint64_t;
+
+// the spans every stream has.  time is in microseconds since the epoch.
+enum class span_kind : uint8_t {
+	BYTES,
+	INDEX,
+	TIME,
+	CUSTOM // named by a string
+};
+
+// a span to address a stream by.  the built in kinds carry no string, so using them allocates nothing.
+class span
+{
+public:
+	span(span_kind kind = span_kind::BYTES)
+	: _kind(kind)
+	{ }
+
+	// names of built in spans give the built in kind
+	span(std::string name)
+	: _kind(span_kind::CUSTOM)
+	{
+		for (auto kind : {span_kind::BYTES, span_kind::INDEX, span_kind::TIME}) {
+			if (name == span(kind).name()) {
+				_kind = kind;
+				return;
+			}
+		}
+		_name = std::move(name);
+	}
+
+	span(char const * name)
+	: span(std::string(name))
+	{ }
+
+	span_kind kind() const { return _kind; }
+
+	std::string const & name() const
+	{
+		static std::string const names[] = {"bytes", "index", "time"};
+		return _kind == span_kind::CUSTOM ? _name : names[static_cast<size_t>(_kind)];
+	}
+
+	bool operator==(span const & other) const { return _kind == other._kind && _name == other._name; }
+	bool operator!=(span const & other) const { return !(*this == other); }
+	bool operator<(span const & other) const { return _kind < other._kind || (_kind == other._kind && _name < other._name); }
+
+private:
+	span_kind _kind;
+	std::string _name;
+};
 
+// an append-only sequence of chunks, kept in storage.  any chunk is found with a number of fetches logarithmic in their count.
 class stream
 {
 public:
 	stream();
+	// opens an existing stream by the identifiers of its tail, filling in any more that are found
 	stream(game::identifiers & identifiers);
+	stream(stream const &) = delete;
+	~stream();
 
-	void read(std::vector<uint8_t> & data, offset_t offset, std::string span = "bytes"/*, std::string flow = "real"*/);
-};
-	void write(std::vector<uint8_t> const & data, offset_t offset = -1, std::string span = "bytes"/*, std::string flow = "real"*/);
+	// data is the chunk holding offset.  for bytes it starts at offset, for other spans it is the whole chunk.
+	void read(buffer & data, offset_t offset, game::span const & span = span_kind::BYTES/*, std::string flow = "real"*/);
+
+	// the default offset appends
+	void write(buffer const & data, offset_t offset = ~offset_t(0), game::span const & span = span_kind::BYTES/*, std::string flow = "real"*/);
+
+	std::map<game::span, std::pair<offset_t, offset_t>> chunk_spans(game::span const & span, offset_t offset/*, std::string flow = "real"*/);
+
+	std::pair<offset_t, offset_t> chunk_span(game::span const & span, offset_t offset/*, std::string flow = "real"*/);
+
+	std::map<game::span, std::pair<offset_t, offset_t>> spans(/*std::string flow = "real"*/);
+
+	std::pair<offset_t, offset_t> span(game::span const & span/*, std::string flow = "real"*/);
+
+	std::map<game::span, offset_t> lengths(/*std::string flow = "real"*/);
 
-	std::map<std::string, std::pair<offset_t, offset_t>> chunk_spans(std::string span, offset_t offset/*, std::string flow = "real"*/);
+	offset_t length(game::span const & span/*,std::string flow = "real"*/);
 
-	std::pair<offset_t, offset_t> chunk_span(std::string span, offset_t offset/*, std::string flow = "real"*/);
+	// the same calls with the span fixed at compile time
+	template <span_kind kind>
+	void read(buffer & data, offset_t offset) { read(data, offset, kind); }
 
-	std::map<std::string,std::pair<offset_t, offset_t>> spans(/*std::string flow = "real"*/);
+	template <span_kind kind>
+	std::pair<offset_t, offset_t> chunk_span(offset_t offset) { return chunk_span(kind, offset); }
 
-	std::pair<offset_t, offset_t> span(std::string span/*, std::string flow = "real"*/);
+	template <span_kind kind>
+	std::pair<offset_t, offset_t> span() { return span(kind); }
 
-	std::map<std::string, offset_t> lengths(/*std::string flow = "real"*/);
+	template <span_kind kind>
+	offset_t length() { return length(kind); }
 
-	offset_t length(std::string span/*,std::string flow = "real"*/);
+	// reading and writing on the library's shared threads (see async.hpp), with any error in the future.
+	// writes are made in the order they were queued.  the stream waits for queued writes and reads when destroyed.
+	std::future<buffer> read_async(offset_t offset, game::span const & span = span_kind::BYTES);
+
+	std::future<void> write_async(buffer data, offset_t offset = ~offset_t(0), game::span const & span = span_kind::BYTES);
 
 	game::identifiers identifiers();
 
 private:
 	struct node;
 
-	node * tail;
-	std::unordered_map<std::string, std::unique_ptr<node>> cache;
+	std::shared_ptr<node const> current_tail();
+	// the node whose chunk holds offset
+	std::shared_ptr<node const> locate(game::span const & span, offset_t offset);
+
+	// runs queued writes in turn until there are none.  only one runs at once.
+	void write_queued();
+
+	// counts a read_async as done.  it touches nothing after, as the stream may then be destroyed.
+	void read_done();
+
+	std::mutex mtx;
+	std::mutex writemtx;
+	std::shared_ptr<node const> tail;
+
+	std::mutex queuemtx;
+	std::condition_variable queue_empty; // notified when the write queue empties and as each read finishes
+	std::deque<std::function<void()>> write_queue;
+	size_t reads_running = 0;
+};
+
 }
@@ -0,0 +1,111 @@
+#include <game/async.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace game;
+
+namespace {
+
+class async_pool
+{
+public:
+	async_pool()
+	: wanted(max(thread::hardware_concurrency(), 4u)), stopping(false)
+	{ }
+
+	// queued work is all run before the pool is destroyed
+	~async_pool()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+		}
+		queued.notify_all();
+		for (auto & thread : threads) {
+			thread.join();
+		}
+	}
+
+	void post(function<void()> work)
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			work_queue.push_back(move(work));
+			start_threads();
+		}
+		queued.notify_one();
+	}
+
+	void resize(size_t count)
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			wanted = max(count, size_t(1));
+			if (work_queue.size()) {
+				start_threads();
+			}
+		}
+		queued.notify_all();
+	}
+
+private:
+	mutex mtx;
+	condition_variable queued;
+	deque<function<void()>> work_queue;
+	vector<thread> threads;
+	size_t running = 0;
+	size_t wanted;
+	bool stopping;
+
+	// threads are started as work first arrives, so a process that never uses them has none.  called with mtx held.
+	void start_threads()
+	{
+		while (running < wanted) {
+			++ running;
+			threads.emplace_back(&async_pool::run, this);
+		}
+	}
+
+	void run()
+	{
+		unique_lock<mutex> lock(mtx);
+		while ("running") {
+			// threads beyond the wanted count leave, and are joined when the pool is destroyed
+			if (running > wanted || (stopping && !work_queue.size())) { break; }
+			if (!work_queue.size()) {
+				queued.wait(lock);
+				continue;
+			}
+			auto work = move(work_queue.front());
+			work_queue.pop_front();
+			lock.unlock();
+			work();
+			lock.lock();
+		}
+		-- running;
+	}
+};
+
+async_pool & pool()
+{
+	static async_pool threads;
+	return threads;
+}
+
+}
+
+void game::async_post(function<void()> work)
+{
+	pool().post(move(work));
+}
+
+void game::async_threads(size_t count)
+{
+	pool().resize(count);
+}
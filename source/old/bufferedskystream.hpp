@@ -1,3 +1,4 @@
+#include <deque>
 #include <functional>
 #include <thread>
 #include <map>
@@ -17,19 +18,141 @@
 // seems time to make a bufferedskystreams class
 // so a pointer to it can be passed to bufferedskystream
 
-// runs the net pumps of multiple skystreams together
 class bufferedskystream;
+
+// a stream's place among those waiting on a pump
+struct pump_entry
+{
+	bufferedskystream * stream;
+	uint64_t priority = 0;
+	size_t position = npos; // in the heap, if there
+	bool busy = false; // taken by a pump
+	static constexpr size_t npos = ~size_t(0);
+};
+
+// streams waiting on a pump, neediest first.  each stream keeps its own place in the heap,
+// so changing how needy it is takes logarithmic time however many streams there are.
+// a stream taken by a pump leaves the heap until the pump is done, so no two pumps work on one stream at once.
+class pump_schedule
+{
+public:
+	// 0 means the stream has nothing for a pump.  a stream being pumped is placed once the pump is done.
+	void set(pump_entry & place, uint64_t priority)
+	{
+		bool added = false;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			place.priority = priority;
+			if (place.busy) { return; }
+			if (!priority) {
+				if (place.position != pump_entry::npos) {
+					remove(place.position);
+				}
+				return;
+			}
+			if (place.position == pump_entry::npos) {
+				place.position = heap.size();
+				heap.push_back(&place);
+				added = true;
+			}
+			sift(place.position);
+		}
+		if (added) {
+			ready.notify_one();
+		}
+	}
+
+	// waits for the neediest stream and takes it.  null once stopped with none left.
+	bufferedskystream * take()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		while (!heap.size()) {
+			if (stopping) { return nullptr; }
+			ready.wait(lock);
+		}
+		auto & place = *heap.front();
+		remove(0);
+		place.busy = true;
+		// the priority is used up, and set again by whatever needs another pump
+		place.priority = 0;
+		return place.stream;
+	}
+
+	void done(pump_entry & place)
+	{
+		uint64_t priority;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			place.busy = false;
+			priority = place.priority;
+		}
+		set(place, priority);
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		ready.notify_all();
+	}
+
+private:
+	std::mutex mtx;
+	std::condition_variable ready;
+	std::vector<pump_entry *> heap;
+	bool stopping = false;
+
+	uint64_t priority(size_t position) { return heap[position]->priority; }
+
+	void swap(size_t a, size_t b)
+	{
+		std::swap(heap[a], heap[b]);
+		heap[a]->position = a;
+		heap[b]->position = b;
+	}
+
+	// moves an entry whose priority changed to where it belongs
+	void sift(size_t position)
+	{
+		while (position && priority((position - 1) / 2) < priority(position)) {
+			swap(position, (position - 1) / 2);
+			position = (position - 1) / 2;
+		}
+		for (size_t child; (child = position * 2 + 1) < heap.size(); position = child) {
+			if (child + 1 < heap.size() && priority(child) < priority(child + 1)) { ++ child; }
+			if (priority(child) <= priority(position)) { break; }
+			swap(position, child);
+		}
+	}
+
+	void remove(size_t position)
+	{
+		swap(position, heap.size() - 1);
+		heap.back()->position = pump_entry::npos;
+		heap.pop_back();
+		if (position < heap.size()) {
+			sift(position);
+		}
+	}
+};
+
+// runs the net pumps of multiple skystreams together
 class bufferedskystreams
 {
 friend class bufferedskystream;
 public:
-	bufferedskystreams(sia::portalpool & portalpool, size_t maxblocksize = 1024*1024*128, std::function<void(bufferedskystream&,uint64_t)> down_callback = {}, std::function<void(bufferedskystream&,uint64_t)> up_callback = {})
+	// pumps is how many threads pump each direction, each working on a different stream
+	bufferedskystreams(sia::portalpool & portalpool, size_t maxblocksize = 1024*1024*128, std::function<void(bufferedskystream&,uint64_t)> down_callback = {}, std::function<void(bufferedskystream&,uint64_t)> up_callback = {}, size_t pumps = 4)
 	: portalpool(portalpool),
 	  maxblocksize(maxblocksize)
 	{
 		pumping = true;
-		down_thread = std::thread(&bufferedskystreams::pump_down, this);
-		up_thread = std::thread(&bufferedskystreams::pump_up, this);
+		for (size_t i = 0; i < std::max(pumps, size_t(1)); ++ i) {
+			down_threads.emplace_back(&bufferedskystreams::pump_down, this);
+			up_threads.emplace_back(&bufferedskystreams::pump_up, this);
+		}
 	}
 	~bufferedskystreams()
 	{
@@ -70,15 +193,11 @@ private:
 	sia::portalpool & portalpool;
 	size_t maxblocksize;
 
-	std::condition_variable down_new;
-	std::condition_variable up_new;
-	std::multimap<uint64_t,bufferedskystream*,std::greater<uint64_t>> down_priorities;
-	std::multimap<uint64_t,bufferedskystream*,std::greater<uint64_t>> up_priorities;
-	std::mutex down_priorities_mutex;
-	std::mutex up_priorities_mutex;
+	pump_schedule down_schedule;
+	pump_schedule up_schedule;
 
-	std::thread down_thread;
-	std::thread up_thread;
+	std::vector<std::thread> down_threads;
+	std::vector<std::thread> up_threads;
 	std::function<void(bufferedskystream&,uint64_t)> up_callback, down_callback;
 
 	void pump_down();
@@ -93,6 +212,8 @@ public:
 	  group(group),
 	  _index(index)
 	{
+		// the down pump schedules its own downloads
+		readahead(0);
 		start();
 	}
 
@@ -121,8 +242,8 @@ public:
 			}
 			pumping = false;
 		}
-		group.down_new.notify_all();
-		group.up_new.notify_all();
+		moredatadown.notify_all();
+		uploaded.notify_all();
 	}
 
 	uint64_t sizeup()
@@ -153,41 +274,35 @@ public:
 		uploaded = offsetup;
 	}
 
-	void queue_local_up(std::vector<uint8_t> && data)
+	// the data is queued where it is, without copying
+	void queue_local_up(std::vector<uint8_t> && vector)
 	{
+		game::buffer data(std::move(vector));
 		size_t uploaded = 0;
 		while (uploaded < data.size()) {
 			size_t toupload = data.size() - uploaded;
 			{
-				std::unique_lock lock(group.up_priorities_mutex);
+				std::unique_lock lock(upmutex);
 				if (group.maxblocksize > 0) {
-					while (queueup.size() >= group.maxblocksize*2) {
+					while (queueupsize >= group.maxblocksize*2) {
 						this->uploaded.wait(lock);
 					}
-					if (queueup.size() + toupload > group.maxblocksize*2) {
-						toupload = group.maxblocksize*2 - queueup.size() ;
+					if (queueupsize + toupload > group.maxblocksize*2) {
+						toupload = group.maxblocksize*2 - queueupsize;
 					}
 				}
 				{
 					std::unique_lock lock(mutex);
 					tailup += toupload;
 				}
-				queueup.insert(queueup.end(), data.begin() + uploaded, data.begin() + uploaded + toupload);
-				if (queueup.size() != uppriority) {
-					for (auto range = group.up_priorities.equal_range(uppriority); range.first != range.second; ++range.first) {
-						if (range.first->second == this) {
-							group.up_priorities.erase(range.first);
-							break;
-						}
-					}
-					uppriority = queueup.size();
-				}
-				assert(uppriority);
-				auto spot = group.up_priorities.emplace(uppriority, this);
-				if (spot == group.up_priorities.begin()) {
-					lock.unlock();
-					group.up_new.notify_all();
-				}
+				queueup.push_back(data.slice(uploaded, toupload));
+				queueupsize += toupload;
+				group.up_schedule.set(up_entry, queueupsize);
+				// hashed outside upmutex, so the pump and other writers are not held up.
+				// hashmutex is taken first, so data is still hashed in the order it was queued.
+				std::unique_lock hashing(hashmutex);
+				lock.unlock();
+				digest_local_up(data.data() + uploaded, toupload);
 			}
 			uploaded += toupload;
 		}
@@ -222,35 +337,39 @@ public:
 		try {
 			//std::cerr << "Looking for workers to download " << offset << " to " << tail << std::endl;
 
-			// The first reason this is slow appears to be the time spent downloading the tree in the block_span call.  This call would be avoided by downloading by index instead of by bytes.
+			// chunks are found in the stream's manifest once it is built, so workers are dispatched without waiting on the tree
 
 			// start by waiting for at least one
 			while (0 == (worker = portalpool.takeworkerout(sia::skynet_multiportal::download, false))) {
 				std::unique_lock<std::mutex> lock(portalpool.worker_lists);
 				portalpool.worker_free.wait(lock);
 			}
-			auto range = block_span("bytes", offset, worker);
-			auto d = new downloader(*this, worker, range.first, range.second);
+			auto chunk = chunk_at(offset, worker);
+			auto d = new downloader(*this, worker, chunk.start, chunk.end);
 			{
 				std::unique_lock<std::mutex> lock(mutex);
-				queuedown[range.first] = std::unique_ptr<downloader>(d);
+				queuedown[chunk.start] = std::shared_ptr<downloader>(d);
 			}
+			// a reader waiting for this block goes on to wait for its pieces
+			moredatadown.notify_all();
 			worker = 0;
-			offset = range.second;
-			// then add more if there are free workers
+			offset = chunk.end;
+			// then add more if there are free workers.  the first block is already on its way, so from here
+			// the stream's manifest is built if it is not yet, and later blocks are found without walking the tree.
 			while ((worker = portalpool.takeworkerout(sia::skynet_multiportal::download, false))) {
-				range = block_span("bytes", offset, worker);
-				d = new downloader(*this, worker, range.first, range.second);
+				chunk = chunk_at(offset, worker, true);
+				d = new downloader(*this, worker, chunk.start, chunk.end);
 				{
 					std::unique_lock<std::mutex> lock(mutex);
-					queuedown[range.first] = std::unique_ptr<downloader>(d);
+					queuedown[chunk.start] = std::shared_ptr<downloader>(d);
 				}
+				moredatadown.notify_all();
 				worker = 0;
-				offset = range.second;
-				range = block_span("bytes", offset);
+				offset = chunk.end;
+				chunk_at(offset);
 			}
 		} catch (std::out_of_range) { } // thrown at end of stream
-				// note workers and calls to block_span
+				// note workers and calls to chunk_at
 				// are ordered so as to workaround not
 				// having implemented RAII for struct worker
 				// in the face of the out_of_range exception
@@ -263,7 +382,9 @@ public:
 	}
 
 	std::mutex read_mutex;
-	std::vector<uint8_t> xfer_local_down(uint64_t offset, uint64_t size = 0, int64_t eventualtail = -1)
+	// returns slices of the downloaded blocks covering the range, in order, without copying them together.
+	// waits only until some of the range has arrived, so a block is passed on in pieces while it downloads.
+	std::vector<game::buffer> xfer_local_down(uint64_t offset, uint64_t size = 0, int64_t eventualtail = -1)
 	{
 		if (eventualtail == -1) {
 			eventualtail = span("bytes").second;
@@ -272,79 +393,78 @@ public:
 			size = eventualtail - offset;
 		}
 		std::lock_guard<std::mutex> read_lock(read_mutex);
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			taildown = eventualtail;
-			// remove queued items outside expected range
-			for (auto it = queuedown.begin(); it != queuedown.end();) {
-				// for now this mutex waits for completion
-				// ideally there would be a way to cancel skynet txs
-				// we could also move it to some other list
-				std::unique_lock lock(it->second->mutex);
-				if (it->first > taildown || it->first + it->second->data.size() < offset) {
-					auto backup = std::move(it->second);
-					it = queuedown.erase(it);
-					lock.unlock();
-				} else {
-					++ it;
-				}
+		// found before taking the lock, as it may fetch metadata, and the pumps need the lock meanwhile
+		auto chunk = chunk_at(offset);
+		std::vector<std::shared_ptr<downloader>> dropped; // destroyed after the lock, as they wait for their transfers
+		std::unique_lock<std::mutex> lock(mutex);
+		taildown = eventualtail;
+		// remove queued items outside expected range
+		// ideally there would be a way to cancel skynet txs
+		for (auto it = queuedown.begin(); it != queuedown.end();) {
+			if (it->first > taildown || it->second->tail <= offset) {
+				dropped.emplace_back(std::move(it->second));
+				it = queuedown.erase(it);
+			} else {
+				++ it;
 			}
-			auto range = block_span("bytes", offset);
-			//std::cerr << "range of block around " << offset << " is [" << range.first << "," << range.second << ")" << std::endl;
-			offsetdown = range.first;
 		}
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			// we now need to wait until the queue contains our block.
-			while (pumping && queuedown.count(offsetdown) == 0) {
-				{
-					std::unique_lock lock(group.down_priorities_mutex);
-					for(auto range = group.down_priorities.equal_range(downpriority); range.first != range.second; ++range.first) {
-						if (range.first->second == this) {
-							group.down_priorities.erase(range.first);
-							break;
-						}
-					}
-					downpriority = taildown - offsetdown;
-					auto spot = group.down_priorities.emplace(downpriority,this);
-					if (spot == group.down_priorities.begin()) {
-						lock.unlock();
-						group.down_new.notify_all();
-					}
+		//std::cerr << "range of block around " << offset << " is [" << chunk.start << "," << chunk.end << ")" << std::endl;
+		offsetdown = chunk.start;
+		// we now need to wait until the queue contains our block.
+		while (pumping && queuedown.count(offsetdown) == 0) {
+			group.down_schedule.set(down_entry, taildown - offsetdown);
+			moredatadown.wait(lock);
+		}
+		std::vector<game::buffer> result;
+		size_t position = offset;
+		while (position < offset + size && queuedown.count(offsetdown)) {
+			auto item = queuedown[offsetdown];
+			std::unique_lock itemlock(item->mutex);
+			if (result.empty()) {
+				// the stream lock is let go while waiting, so the pump can queue more blocks
+				lock.unlock();
+				item->downloaded.wait(itemlock, [&]{ return item->done || item->start + item->received > position; });
+				itemlock.unlock();
+				lock.lock();
+				itemlock.lock();
+				if (queuedown.count(offsetdown) == 0 || queuedown[offsetdown] != item) {
+					// dropped by the pump meanwhile
+					break;
 				}
-				moredatadown.wait(lock);
 			}
-			std::vector<uint8_t> result;
-			while (queuedown.count(offsetdown)) {
-				auto & itemr = queuedown[offsetdown];
-				std::scoped_lock(itemr->mutex);
-				if (offset + size < offsetdown + itemr->data.size()) {
-					// request ends before block does
-					if (offsetdown < offset) {
-						result.insert(result.end(), itemr->data.begin() + offset - offsetdown, itemr->data.begin() + offset + size - offsetdown);
-					} else {
-						result.insert(result.end(), itemr->data.begin(), itemr->data.begin() + offset + size - offsetdown);
-					}
-					return result;
+			// pass on whatever of the range has arrived
+			size_t piece_start = item->start;
+			for (auto & piece : item->pieces) {
+				size_t piece_end = piece_start + piece.size();
+				if (piece_end > position && piece_start < offset + size) {
+					size_t begin = position - piece_start;
+					size_t end = std::min(piece_end, offset + size) - piece_start;
+					result.push_back(piece.slice(begin, end - begin));
+					position = piece_start + end;
 				}
-				auto item = std::move(itemr);
-				queuedown.erase(offsetdown);
-				auto itembegin = item->data.begin();
-				if (offset > offsetdown) {
-					itembegin += offset - offsetdown;
-				}
-				result.insert(result.end(), itembegin, item->data.end());
-				//std::cerr << "Ferrying " << (item->data.end() - itembegin) << " bytes" << std::endl;
-				offsetdown += item->data.size();
+				piece_start = piece_end;
+			}
+			if (!item->done || position < item->start + item->received) {
+				// the block continues past what was read or arrived
+				break;
+			}
+			itemlock.unlock();
+			queuedown.erase(offsetdown);
+			if (item->error) {
+				// dropped so that reading again downloads it again.  what arrived before the failure was verified.
+				if (result.size()) { return result; }
+				std::rethrow_exception(item->error);
 			}
-			return result;
+			//std::cerr << "Ferrying " << position - offset << " bytes" << std::endl;
+			offsetdown = item->tail;
+			dropped.emplace_back(std::move(item));
 		}
+		return result;
 	}
 
 	// pump one transfer cycle for uploads, return bytes pumped or -1 if shut down
 	ssize_t xfer_net_up()
 	{
-		std::vector<uint8_t> data;
 		size_t offset;
 		{
 			std::unique_lock<std::mutex> lock(mutex);
@@ -360,53 +480,112 @@ public:
 			offset = offsetup;
 		}
 		// pull data to transfer into local variable
+		nlohmann::json identifiers;
+		std::vector<uint8_t> tree;
+		std::vector<game::buffer> block;
+		size_t blocksize = 0;
 		{
-			std::unique_lock lock(group.up_priorities_mutex);
-			if (group.maxblocksize <= 0 || queueup.size() <= group.maxblocksize) {
-				data = std::move(queueup);
-			} else {
-				data.insert(data.begin(), queueup.begin(), queueup.begin() + group.maxblocksize);
-				queueup.erase(queueup.begin(), queueup.begin() + group.maxblocksize);
+			std::unique_lock lock(upmutex);
+			blocksize = queueupsize;
+			if (group.maxblocksize > 0 && blocksize > group.maxblocksize) {
+				blocksize = group.maxblocksize;
+			}
+			// whole segments are taken and the last one sliced, so nothing left behind is moved
+			for (size_t taken = 0; taken < blocksize;) {
+				auto & segment = queueup.front();
+				if (taken + segment.size() <= blocksize) {
+					taken += segment.size();
+					block.push_back(std::move(segment));
+					queueup.pop_front();
+				} else {
+					block.push_back(segment.slice(0, blocksize - taken));
+					segment = segment.slice(blocksize - taken);
+					taken = blocksize;
+				}
+			}
+			queueupsize -= blocksize;
+			if (blocksize) {
+				// waits for any of the block still being hashed
+				std::unique_lock hashing(hashmutex);
+				if (queueupdigests.size()) {
+					identifiers = std::move(queueupdigests.front().identifiers);
+					tree = std::move(queueupdigests.front().tree);
+					queueupdigests.pop_front();
+				} else {
+					identifiers = updigester.finalize();
+					tree = uptree.finish();
+				}
 			}
 		}
-		if (data.size()) {
-			write(data, "bytes", offset);
+		// writers waiting on a full queue can go on while this block uploads
+		uploaded.notify_all();
+		// write needs the block in one piece.  a block that is one whole queued vector is passed as it is;
+		// otherwise its segments are copied together once, outside the lock.
+		std::shared_ptr<std::vector<uint8_t> const> data;
+		if (block.size() == 1) {
+			data = block[0].vector();
+		} else {
+			auto joined = std::make_shared<std::vector<uint8_t>>();
+			joined->reserve(blocksize);
+			for (auto & segment : block) {
+				joined->insert(joined->end(), segment.begin(), segment.end());
+			}
+			data = std::move(joined);
+		}
+		if (data->size()) {
+			write(*data, "bytes", offset, 0, identifiers, std::move(tree));
 			{
 				std::lock_guard<std::mutex> lock(mutex);
-				offsetup += data.size();
+				offsetup += data->size();
 			}
-			uploaded.notify_all();
 		}
 		{
-			std::unique_lock lock(group.up_priorities_mutex);
-			if (queueup.size() == 0) {
-				assert(uppriority != 0); // logic flow with queue_local_up.  i thought it could be good to have only nonzero priorities in the queue, ever.
-				for (auto range = group.up_priorities.equal_range(uppriority); range.first != range.second; ++range.first) {
-					if (range.first->second == this) {
-						group.up_priorities.erase(range.first);
-						break;
-					}
-				}
-				uppriority = 0;
-			}
+			// any more queued meanwhile gets another pump
+			std::unique_lock lock(upmutex);
+			group.up_schedule.set(up_entry, queueupsize);
 		}
-		return data.size();
+		return data->size();
 	}
 
 	std::mutex mutex;
-	std::condition_variable uploaded; // notified when write queue is emptied
-	std::condition_variable moredatadown; // notified when read queue lengthens
+	std::condition_variable uploaded; // notified when blocks are taken off the write queue
+	std::condition_variable moredatadown; // notified when read queue lengthens, and as each block starts arriving
 
 private:
+	// hashes queued data as it arrives, finishing a block's digests and tree each time a full block has been queued.
+	// xfer_net_up cuts blocks at the same boundaries, so they are ready when it needs them.
+	// called with hashmutex held.
+	void digest_local_up(uint8_t const * data, size_t size)
+	{
+		while (size) {
+			// both take each piece while it is still in cache
+			size_t todigest = std::min(size, hash_piece_size);
+			if (group.maxblocksize > 0 && updigester.size() + todigest > group.maxblocksize) {
+				todigest = group.maxblocksize - updigester.size();
+			}
+			updigester.update(data, todigest);
+			uptree.update(data, todigest);
+			data += todigest;
+			size -= todigest;
+			if (updigester.size() == group.maxblocksize) {
+				queueupdigests.push_back({updigester.finalize(), uptree.finish()});
+			}
+		}
+	}
+
+	friend class bufferedskystreams;
 	friend struct downloader;
 	struct downloader
 	{
 		bufferedskystream & stream;
-		std::thread process;
+		std::future<void> process;
 		size_t start;
 		size_t tail;
-		std::condition_variable downloaded;
-		std::vector<uint8_t> data;
+		std::condition_variable downloaded; // notified as each piece arrives, and when done
+		std::vector<game::buffer> pieces; // verified, in order from start
+		size_t received = 0;
+		bool done = false;
+		std::exception_ptr error;
 		std::mutex mutex;
 
 		downloader(bufferedskystream & stream, sia::portalpool::worker const * worker, size_t node_start, size_t node_end)
@@ -416,21 +595,45 @@ private:
 			start = node_start;
 			tail = node_end;
 			//std::cerr << "Downloading " << start << " to " << tail << std::endl;
-			process = std::thread(&downloader::download, this, std::move(std::unique_lock(mutex)));
+			process = stream.portalpool.run(sia::skynet_multiportal::download, [this]() {
+				download();
+			});
 		}
 		~downloader()
 		{
-			process.join();
+			process.wait();
 		}
 	private:
-		void download(std::unique_lock<std::mutex> && lock)
+		void download()
 		{
-			double offset = start;
-			data = stream.skystream::read("bytes", offset, "real", worker);
+			std::exception_ptr failure;
+			try {
+				stream.skystream::read_pieces(start, [this](game::buffer piece) {
+					bool first;
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						first = pieces.empty();
+						received += piece.size();
+						pieces.emplace_back(std::move(piece));
+					}
+					downloaded.notify_all();
+					if (first) {
+						// the block has begun to arrive, so readers need not wait for the whole of it
+						stream.moredatadown.notify_all();
+					}
+				}, worker);
+			} catch (...) {
+				// the reader sees this once it has passed the pieces that did arrive
+				failure = std::current_exception();
+			}
 			stream.portalpool.putworkerback(worker);
 			worker = 0;
 			//std::cerr << "notifying " << start << std::endl;
-			lock.unlock();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				error = failure;
+				done = true;
+			}
 			downloaded.notify_all();
 			stream.moredatadown.notify_all();
 		}
@@ -443,18 +646,27 @@ private:
 		tailup = offsetup;
 		offsetdown = 0;
 		taildown = 0;
-		downpriority = 0;
-		uppriority = 0;
 	}
 	bufferedskystreams & group;
 	size_t const _index;
 	bool pumping = true;
-	std::map<size_t, std::unique_ptr<downloader>> queuedown;
-	std::vector<uint8_t> queueup;
+	std::map<size_t, std::shared_ptr<downloader>> queuedown;
+	std::deque<game::buffer> queueup; // segments as they were queued
+	size_t queueupsize = 0;
+	game::digester updigester;
+	skytree::builder uptree;
+	struct block_digests
+	{
+		nlohmann::json identifiers;
+		std::vector<uint8_t> tree;
+	};
+	std::deque<block_digests> queueupdigests;
 	size_t offsetdown, taildown;
 	size_t offsetup, tailup;
-	uint64_t downpriority;
-	uint64_t uppriority;
+	std::mutex upmutex; // guards the upload queue
+	std::mutex hashmutex; // guards its digests.  taken while holding upmutex, never the other way
+	pump_entry down_entry{this};
+	pump_entry up_entry{this};
 };
 
 
@@ -467,13 +679,18 @@ void bufferedskystreams::shutdown()
 			stream->shutdown();
 		}
 	}
-	down_new.notify_all();
-	up_new.notify_all();
-	if (down_thread.joinable()) {
-		down_thread.join();
+	// uploads already queued are still pumped before the threads finish
+	down_schedule.stop();
+	up_schedule.stop();
+	for (auto & thread : down_threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
 	}
-	if (up_thread.joinable()) {
-		up_thread.join();
+	for (auto & thread : up_threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
 	}
 }
 
@@ -487,26 +704,9 @@ size_t bufferedskystreams::add(nlohmann::json identifiers)
 
 void bufferedskystreams::pump_down()
 {
-	bufferedskystream * stream;
-	
-	while("pumping") {
-		{
-			std::unique_lock lock(down_priorities_mutex);
-			if (down_priorities.size() == 0) {
-				{
-					std::scoped_lock(streams_mutex);
-					if (!pumping) {
-						return;
-					}
-				}
-				down_new.wait(lock);
-				continue;
-			}
-			stream = down_priorities.begin()->second;
-			// TODO: erase this next line, and have queue_net_down do it like in pump_up
-			down_priorities.erase(down_priorities.begin());
-		}
+	while (auto stream = down_schedule.take()) {
 		ssize_t size = stream->queue_net_down();
+		down_schedule.done(stream->down_entry);
 		if (size > 0) {
 			if (down_callback) {
 				down_callback(*stream, size);
@@ -516,26 +716,9 @@ void bufferedskystreams::pump_down()
 }
 void bufferedskystreams::pump_up()
 {
-	bufferedskystream * stream;
-	decltype(up_priorities)::iterator streamit;
-
-	while("pumping") {
-		{
-			std::unique_lock lock(up_priorities_mutex);
-			if (up_priorities.size() == 0) {
-				{
-					std::scoped_lock(streams_mutex);
-					if (!pumping) {
-						break;
-					}
-				}
-				up_new.wait(lock);
-				continue;
-			}
-			streamit = up_priorities.begin();
-			stream = streamit->second;
-		}
-		ssize_t size = stream->xfer_net_up(); // empties itself from up_priorities
+	while (auto stream = up_schedule.take()) {
+		ssize_t size = stream->xfer_net_up(); // sets its own priority again if more is queued
+		up_schedule.done(stream->up_entry);
 		if (size > 0) {
 			if (up_callback) {
 				up_callback(*stream, size);
@@ -5,6 +5,8 @@
 #include <sstream>
 #include <cstdio>
 #include <cstring>
+#include <climits>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "tools.hpp"
@@ -88,21 +90,34 @@ int main(int argc, char **argv)
 	                std::cerr << "Finished queuing download of " << size << " bytes" << std::endl;
 		});
 		while (offset < end) {
-			auto data = stream.xfer_local_down(offset, 0, end);
+			auto slices = stream.xfer_local_down(offset, 0, end);
+			std::vector<struct iovec> iovecs;
+			size_t total = 0;
+			for (auto & slice : slices) {
+				iovecs.push_back({const_cast<uint8_t *>(slice.data()), slice.size()});
+				total += slice.size();
+			}
 			{
 				std::scoped_lock lock(outputline);
-				std::cerr << "Downloaded " << data.size() << " bytes" << std::endl;
+				std::cerr << "Downloaded " << total << " bytes" << std::endl;
 			}
-			size_t suboffset = 0;
-			while (suboffset < data.size()) {
-				ssize_t size = write(1, data.data() + suboffset, data.size() - suboffset);
+			// the slices go straight from the downloaded blocks to stdout
+			auto next = iovecs.begin();
+			while (next != iovecs.end()) {
+				ssize_t size = writev(1, &*next, std::min<size_t>(iovecs.end() - next, IOV_MAX));
 				if (size < 0) {
-					perror("write");
+					perror("writev");
 					return size;
 				}
-				suboffset += size;
+				for (; next != iovecs.end() && (size_t)size >= next->iov_len; ++ next) {
+					size -= next->iov_len;
+				}
+				if (size) {
+					next->iov_base = (uint8_t *)next->iov_base + size;
+					next->iov_len -= size;
+				}
 			}
-			offset += data.size();
+			offset += total;
 		}
 		streams.shutdown();
 	} else if (options.count("up")) {
@@ -118,9 +133,8 @@ int main(int argc, char **argv)
 		auto range = stream.span("bytes");
 		double offset = range.second;
 		std::cerr << "Uploading to " << options["up"] << " from stdin starting from " << "bytes" << " " << (uint64_t)offset << std::endl;
-		std::vector<uint8_t> data;
-		data.reserve(1024*1024*16);
-		data.resize(data.capacity());
+		size_t const readsize = 1024*1024*16;
+		std::vector<uint8_t> data(readsize);
 		ssize_t size;
 		std::mutex outputline;
 		streams.set_up_callback([&outputline,&options](bufferedskystream&stream, uint64_t size){
@@ -133,14 +147,19 @@ int main(int argc, char **argv)
 				perror("read");
 				return size;
 			}
-			data.resize(size);
-			stream.queue_local_up(std::move(data));
+			if ((size_t)size == data.size()) {
+				// the queue keeps a full vector, so reading continues into a new one
+				stream.queue_local_up(std::move(data));
+				data = std::vector<uint8_t>(readsize);
+			} else {
+				// a short read is copied out at its own size, so the queue never holds mostly-empty capacity
+				stream.queue_local_up(std::vector<uint8_t>(data.begin(), data.begin() + size));
+			}
 			{
 				std::scoped_lock lock(outputline);
 				std::cerr << "Queued upload of " << size << " bytes" << std::endl;
 			}
 			offset += size;
-			data.resize(data.capacity());
 		}
 		streams.shutdown();
 	}
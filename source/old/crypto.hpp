@@ -1,5 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <game/digests.hpp>
+#include <game/mdctx.hpp>
+
 #include <openssl/conf.h>
 #include <openssl/evp.h>
 #include <openssl/err.h>
@@ -11,12 +18,10 @@ public:
 	{
 		ERR_load_crypto_strings();
 		OpenSSL_add_all_algorithms();
-		mdctx = EVP_MD_CTX_create();
 	}
 	crypto(crypto &&) = default;
 	~crypto()
 	{
-		EVP_MD_CTX_destroy(mdctx);
 		EVP_cleanup();
 		CRYPTO_cleanup_all_ex_data();
 		ERR_free_strings();
@@ -27,14 +32,16 @@ public:
 		static thread_local std::vector<uint8_t> bytes;
 		bytes.resize(EVP_MAX_MD_SIZE);
 
-		EVP_DigestInit_ex(mdctx, algorithm, NULL);
+		auto mdctx = game::take_mdctx();
+		game::mdctx_init(mdctx.get(), algorithm);
 
 		for (auto & chunk : data) {
-			EVP_DigestUpdate(mdctx, chunk->data(), chunk->size());
+			EVP_DigestUpdate(mdctx.get(), chunk->data(), chunk->size());
 		}
 
 		unsigned int size;
-		EVP_DigestFinal_ex(mdctx, bytes.data(), &size);
+		EVP_DigestFinal_ex(mdctx.get(), bytes.data(), &size);
+		game::put_mdctx_back(std::move(mdctx));
 		bytes.resize(size);
 
 		result.resize(size * 2);
@@ -48,17 +55,31 @@ public:
 		}
 		return result;
 	}
-	nlohmann::json digests(std::initializer_list<std::vector<uint8_t> const *> data)
+
+	// the digest of one run of bytes, unencoded, written to out which must have room for EVP_MAX_MD_SIZE bytes.  returns its length.
+	unsigned digest_raw(uint8_t const * data, size_t size, decltype(EVP_sha3_512()) algorithm, uint8_t * out)
 	{
-		return {
-#ifndef OPENSSL_NO_BLAKE2
-			{"blake2b512", digest(data, EVP_blake2b512())},
-#endif
-			{"sha3_512", digest(data, EVP_sha3_512())},
-			{"sha512_256", digest(data, EVP_sha512_256())}
-		};
+		auto mdctx = game::take_mdctx();
+		game::mdctx_init(mdctx.get(), algorithm);
+		EVP_DigestUpdate(mdctx.get(), data, size);
+		unsigned length;
+		EVP_DigestFinal_ex(mdctx.get(), out, &length);
+		game::put_mdctx_back(std::move(mdctx));
+		return length;
 	}
 
-private:
-	EVP_MD_CTX * mdctx;
+	nlohmann::json digests(std::initializer_list<std::vector<uint8_t> const *> data)
+	{
+		game::digester result;
+		for (auto & chunk : data) {
+			result.update(*chunk);
+		}
+		return result.finalize();
+	}
+	nlohmann::json digests(uint8_t const * data, size_t size)
+	{
+		game::digester result;
+		result.update(data, size);
+		return result.finalize();
+	}
 };
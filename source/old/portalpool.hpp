@@ -1,6 +1,17 @@
 #include <siaskynet_multiportal.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <stdexcept>
 #include <thread>
+#include <utility>
 
 // For outputting a message on stderr when a portal fails
 #include <iostream>
@@ -12,20 +23,83 @@ public:
 	portalpool(double bytes_bandwidth_down = 1024, double bytes_bandwidth_up = 1024, size_t connections_down = 8, size_t connections_up = 4)
 	: bandwidth{bytes_bandwidth_down / connections_down, bytes_bandwidth_up / connections_up}
 	{
+		auto portals = skynet::portals();
+		if (!portals.size()) {
+			portals.push_back(skynet().options);
+		}
+		for (auto kind : {skynet_multiportal::download, skynet_multiportal::upload}) {
+			for (auto & options : portals) {
+				stats[kind].emplace_back(portal_stats{options});
+			}
+		}
 		for (size_t i = 0; i < connections_down; ++ i) {
-			workers[skynet_multiportal::download].emplace_back(worker{i, std::unique_ptr<skynet>(new skynet())});
+			workers[skynet_multiportal::download].emplace_back(worker{i, skynet_multiportal::download, std::unique_ptr<skynet>(new skynet())});
 			free[skynet_multiportal::download].push_back(i);
 		}
 		for (size_t i = 0; i < connections_up; ++ i) {
-			workers[skynet_multiportal::upload].emplace_back(worker{i, std::unique_ptr<skynet>(new skynet())});
+			workers[skynet_multiportal::upload].emplace_back(worker{i, skynet_multiportal::upload, std::unique_ptr<skynet>(new skynet())});
 			free[skynet_multiportal::upload].push_back(i);
 		}
+		for (auto kind : {skynet_multiportal::download, skynet_multiportal::upload}) {
+			for (size_t i = 0; i < workers[kind].size(); ++ i) {
+				runners[kind].emplace_back(&portalpool::run_tasks, this, kind);
+			}
+		}
+		// every download try holds a worker, so there are never more tries than these to run them
+		for (size_t i = 0; i < connections_down; ++ i) {
+			racers.emplace_back(&portalpool::run_attempts, this);
+		}
+	}
+
+	~portalpool()
+	{
+		{
+			std::unique_lock<std::mutex> lock(tasks_mutex);
+			stopping = true;
+		}
+		for (auto kind : {skynet_multiportal::download, skynet_multiportal::upload}) {
+			task_queued[kind].notify_all();
+			for (auto & runner : runners[kind]) {
+				runner.join();
+			}
+		}
+		{
+			// downloads left behind by a race finish on their own, within their timeout
+			std::unique_lock<std::mutex> lock(tasks_mutex);
+			attempts_stopping = true;
+		}
+		attempt_queued.notify_all();
+		for (auto & racer : racers) {
+			racer.join();
+		}
 	}
 
 	struct worker {
 		size_t index;
+		skynet_multiportal::transfer_kind kind;
 		std::unique_ptr<skynet> portal;
-		skynet_multiportal::transfer transfer;
+	};
+
+	// a transfer started by workstart, kept by whoever is doing it so a worker can carry more than one
+	struct transfer {
+		skynet_multiportal::transfer_kind kind;
+		size_t portal_index; // into stats
+		std::chrono::steady_clock::time_point started;
+	};
+
+	// how a portal has been doing, as moving averages over its recent transfers of one kind
+	struct portal_stats {
+		skynet::portal_options options;
+		double latency = 0; // seconds a transfer takes before its size counts
+		double throughput = 0; // bytes per second once it is going
+		double deviation = 0; // seconds transfers have taken more or less than expected
+		double errors = 0; // share of transfers that fail
+		size_t transfers = 0;
+		size_t active = 0;
+		std::chrono::steady_clock::time_point last{}; // when it was last given a transfer
+		size_t failures = 0; // in a row
+		size_t trips = 0; // times its breaker has opened since it last succeeded
+		std::chrono::steady_clock::time_point open_until{}; // out of rotation until then
 	};
 
 	worker const * takeworkerout(skynet_multiportal::transfer_kind kind, bool block = true)
@@ -40,47 +114,192 @@ public:
 		return w;
 	}
 
-	void workstart(worker const * w, skynet_multiportal::transfer_kind kind)
+	// points the worker at the portal expected to finish a transfer of this size soonest
+	transfer workstart(worker const * w, skynet_multiportal::transfer_kind kind, size_t size = 0)
 	{
-		const_cast<worker *>(w)->transfer = multiportal.begin_transfer(kind);
-		const_cast<worker *>(w)->portal->options = w->transfer.portal;
+		transfer started{kind, choose(kind, size), std::chrono::steady_clock::now()};
+		w->portal->options = stats[kind][started.portal_index].options;
+		return started;
+	}
+
+	// a size of 0 is a failed transfer
+	void workstop(transfer const & done, size_t size) {
+		record(done.kind, done.portal_index, done.started, size);
 	}
 
-	void workstop(worker const * w, size_t size) {
-		multiportal.end_transfer(w->transfer, size);
+	// takes the portal expected to finish a transfer of this size soonest, and counts the transfer as started on it.
+	// a size of 0 is taken to be the average size of transfers of this kind.
+	// portals with their breaker open are passed over unless all are, and exclude is passed over unless it is the only portal.
+	size_t choose(skynet_multiportal::transfer_kind kind, size_t size = 0, size_t exclude = npos)
+	{
+		std::unique_lock<std::mutex> lock(stats_mutex);
+		auto & portals = stats[kind];
+		auto now = std::chrono::steady_clock::now();
+		if (!size) {
+			size = average_size[kind];
+		}
+		// now and then the portal left alone longest is tried, so one that has recovered is noticed
+		bool explore = ++ started[kind] % explore_every == 0;
+		size_t best = npos;
+		double best_score = 0;
+		for (size_t i = 0; i < portals.size(); ++ i) {
+			if (i == exclude || portals[i].open_until > now) { continue; }
+			double score = explore
+				? std::chrono::duration<double>(portals[i].last - now).count()
+				: expected_time(portals[i], size);
+			if (best == npos || score < best_score) {
+				best = i;
+				best_score = score;
+			}
+		}
+		if (best == npos) {
+			// the breaker closing soonest is let through
+			for (size_t i = 0; i < portals.size(); ++ i) {
+				if (i == exclude && portals.size() > 1) { continue; }
+				if (best == npos || portals[i].open_until < portals[best].open_until) { best = i; }
+			}
+		}
+		auto & portal = portals[best];
+		++ portal.active;
+		portal.last = now;
+		return best;
 	}
 
+	// counts a transfer started by choose as done.  a size of 0 is a failed transfer.
+	void record(skynet_multiportal::transfer_kind kind, size_t index, std::chrono::steady_clock::time_point started, size_t size)
+	{
+		auto now = std::chrono::steady_clock::now();
+		double seconds = std::max(std::chrono::duration<double>(now - started).count(), 0.000001);
+		std::unique_lock<std::mutex> lock(stats_mutex);
+		auto & portal = stats[kind][index];
+		-- portal.active;
+		++ portal.transfers;
+		portal.errors += ((size ? 0.0 : 1.0) - portal.errors) * smoothing;
+		if (!size) {
+			if (++ portal.failures >= breaker_failures) {
+				// each time it trips again without succeeding it is left out for twice as long
+				double out = breaker_seconds * (1 << std::min(portal.trips, size_t(5)));
+				++ portal.trips;
+				portal.failures = breaker_failures - 1; // so a failed probe trips it again
+				portal.open_until = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(out));
+				std::cerr << portal.options.url << ": out of rotation for " << out << "s" << std::endl;
+			}
+			return;
+		}
+		portal.failures = 0;
+		portal.trips = 0;
+		average_size[kind] += (size - average_size[kind]) * smoothing;
+		if (portal.throughput <= 0) {
+			// with one transfer there is no telling latency from throughput, so each is given half
+			portal.latency = seconds / 2;
+			portal.throughput = size / (seconds / 2);
+			portal.deviation = seconds / 2;
+			return;
+		}
+		// the time is split between latency and throughput using the estimate of each so far
+		double expected = portal.latency + size / portal.throughput;
+		double latency = std::max(seconds - size / portal.throughput, 0.0);
+		double throughput = size / std::max(seconds - portal.latency, seconds / 2);
+		portal.deviation += (std::abs(seconds - expected) - portal.deviation) * smoothing;
+		portal.latency += (latency - portal.latency) * smoothing;
+		portal.throughput += (throughput - portal.throughput) * smoothing;
+	}
+
+	std::vector<portal_stats> portal_statistics(skynet_multiportal::transfer_kind kind)
+	{
+		std::unique_lock<std::mutex> lock(stats_mutex);
+		return stats[kind];
+	}
+
+	// a transfer queued for a worker is given this one rather than it being freed
 	void putworkerback(worker const * w) {
+		std::function<void(worker const *)> next;
 		{
 			std::unique_lock<std::mutex> lock(worker_lists);
-			free[w->transfer.kind].push_back(w->index);
+			auto & queued = waiting[w->kind];
+			if (queued.size()) {
+				next = std::move(queued.front());
+				queued.pop_front();
+			} else {
+				free[w->kind].push_back(w->index);
+			}
+		}
+		if (next) {
+			next(w);
+		} else {
+			worker_free.notify_all();
 		}
-		worker_free.notify_all();
 	}
 
-	skynet::response download(std::string const & skylink, std::initializer_list<std::pair<size_t, size_t>> ranges = {}, size_t maxsize = 1024*1024*64, bool fail = false, worker const * w = 0)
+	// ranges are first and last byte offsets, as in an http Range header.  only one range is taken at a time.
+	// a download still going past about the 95th percentile of its portal's times is raced on a second portal, if a worker is free to carry it.
+	// failures are retried with backoff up to max_tries times before throwing, or with fail not retried and an empty response returned.
+	skynet::response download(std::string const & skylink, std::vector<std::pair<size_t, size_t>> const & ranges = {}, size_t maxsize = 1024*1024*64, bool fail = false, worker const * w = 0)
 	{
-		auto timeout = std::chrono::milliseconds((unsigned long)(1000 * maxsize / bandwidth[skynet_multiportal::download]));
+		if (ranges.size() > 1) {
+			// skynet takes ranges as an initializer list, which cannot be built at runtime
+			throw std::invalid_argument("portalpool downloads one range at a time");
+		}
+		size_t size = 0;
+		for (auto & range : ranges) {
+			size += range.second + 1 - range.first;
+		}
 
 		auto worker = w;
 		skynet::response result;
 		if (w == 0) {
 			worker = takeworkerout(skynet_multiportal::download);
 		}
-		while ("retrying download") {
-			try {
-				workstart(worker, skynet_multiportal::download);
-				result = worker->portal->download(skylink, ranges, timeout);
-				workstop(worker, result.data.size() + result.filename.size());
+		for (size_t tries = 1; ; ++ tries) {
+			auto race = std::make_shared<download_race>();
+			size_t first = choose(skynet_multiportal::download, size);
+			race_download(race, first, skylink, ranges, timeout(skynet_multiportal::download, first, size, maxsize));
+			double hedge = hedge_seconds(skynet_multiportal::download, first, size);
+			std::unique_lock<std::mutex> lock(race->mutex);
+			bool hedged = false;
+			while (race->running && !race->won) {
+				// the hedge is timed from when a racer starts the try, so time queued for a racer does not count
+				if (hedged || hedge >= max_timeout_seconds || race->started == std::chrono::steady_clock::time_point::max()) {
+					race->finished.wait(lock);
+				} else if (race->finished.wait_until(lock, race->started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(hedge))) == std::cv_status::timeout && race->running && !race->won) {
+					hedged = true;
+					lock.unlock();
+					// the second try takes a free worker, so tries never outnumber the workers
+					if (auto spare = takeworkerout(skynet_multiportal::download, false)) {
+						size_t second = choose(skynet_multiportal::download, size, first);
+						lock.lock();
+						race->spare = spare;
+						lock.unlock();
+						race_download(race, second, skylink, ranges, timeout(skynet_multiportal::download, second, size, maxsize));
+					}
+					lock.lock();
+				}
+			}
+			bool won = race->won;
+			if (won) {
+				result = std::move(race->result);
+			}
+			// a try left behind keeps the second worker out until it is done
+			race->abandoned = true;
+			auto spare = race->running ? nullptr : std::exchange(race->spare, nullptr);
+			lock.unlock();
+			if (spare) {
+				putworkerback(spare);
+			}
+			if (won) {
 				break;
-			} catch(std::runtime_error const & e) {
-				workstop(worker, 0);
-				std::cerr << worker->portal->options.url << ": " << e.what() << std::endl;
-				if (fail) {
-					result = {};
-					break;
+			}
+			if (fail) {
+				result = {};
+				break;
+			}
+			if (tries >= max_tries) {
+				if (w == 0) {
+					putworkerback(worker);
 				}
+				throw std::runtime_error("download of " + skylink + " failed " + std::to_string(tries) + " times");
 			}
+			backoff(tries);
 		}
 		if (w == 0) {
 			putworkerback(worker);
@@ -88,6 +307,8 @@ public:
 		return result;
 	}
 
+	// failures are retried on the next best portal with backoff, up to max_tries times before throwing,
+	// or with fail not retried and an empty link returned.
 	std::string upload(std::string const & filename, std::vector<skynet::upload_data> const & files, bool fail = false, worker const * w = 0)
 	{
 		auto worker = w;
@@ -95,26 +316,32 @@ public:
 		for (auto & file : files) {
 			size += file.data.size() + file.filename.size() + file.contenttype.size();
 		}
-		auto timeout = std::chrono::milliseconds((unsigned long)(1000 * size / bandwidth[skynet_multiportal::upload]));
 		
 		std::string link;
 		if (w == 0) {
 			worker = takeworkerout(skynet_multiportal::upload);
 		}
-		while ("retrying upload") {
+		for (size_t tries = 1; ; ++ tries) {
+			auto transfer = workstart(worker, skynet_multiportal::upload, size);
 			try {
-				workstart(worker, skynet_multiportal::upload);
-				link = worker->portal->upload(filename, files, timeout);
-				workstop(worker, size);
+				link = worker->portal->upload(filename, files, timeout(skynet_multiportal::upload, transfer.portal_index, size, size));
+				workstop(transfer, size);
 				break;
 			} catch(std::runtime_error const & e) {
-				workstop(worker, 0);
+				workstop(transfer, 0);
 				std::cerr << worker->portal->options.url << ": " << e.what() << std::endl;
 				if (fail) {
 					link = {};
 					break;
 				}
+				if (tries >= max_tries) {
+					if (w == 0) {
+						putworkerback(worker);
+					}
+					throw std::runtime_error("upload of " + filename + " failed " + std::to_string(tries) + " times: " + e.what());
+				}
 			}
+			backoff(tries);
 		}
 		if (w == 0) {
 			putworkerback(worker);
@@ -122,6 +349,63 @@ public:
 		return link;
 	}
 
+	// runs a transfer on the pool's threads, of which there are as many for each kind as there are workers.
+	// tasks do not wait on one another, and are queued with their worker already taken out,
+	// so a queued task never waits on one behind it.
+	template <typename Function>
+	auto run(skynet_multiportal::transfer_kind kind, Function && task) -> std::future<decltype(task())>
+	{
+		auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::forward<Function>(task));
+		auto result = packaged->get_future();
+		{
+			std::unique_lock<std::mutex> lock(tasks_mutex);
+			tasks[kind].emplace_back([packaged]() { (*packaged)(); });
+		}
+		task_queued[kind].notify_one();
+		return result;
+	}
+
+	// runs a transfer with the first worker of its kind to come free, without waiting for one.
+	// the worker is put back when the task is done.
+	template <typename Function>
+	auto run_with_worker(skynet_multiportal::transfer_kind kind, Function && task) -> std::future<decltype(task((worker const *)0))>
+	{
+		auto packaged = std::make_shared<std::packaged_task<decltype(task((worker const *)0))(worker const *)>>(std::forward<Function>(task));
+		auto result = packaged->get_future();
+		std::function<void(worker const *)> start = [this, kind, packaged](worker const * w) {
+			run(kind, [this, packaged, w]() {
+				(*packaged)(w);
+				putworkerback(w);
+			});
+		};
+		worker const * w;
+		{
+			std::unique_lock<std::mutex> lock(worker_lists);
+			if (!free[kind].size()) {
+				waiting[kind].emplace_back(std::move(start));
+				return result;
+			}
+			w = &workers[kind][free[kind].back()];
+			free[kind].pop_back();
+		}
+		start(w);
+		return result;
+	}
+
+	std::future<skynet::response> download_async(std::string const & skylink, size_t maxsize = 1024*1024*64, bool fail = false)
+	{
+		return run_with_worker(skynet_multiportal::download, [this, skylink, maxsize, fail](worker const * w) {
+			return download(skylink, {}, maxsize, fail, w);
+		});
+	}
+
+	std::future<std::string> upload_async(std::string const & filename, std::vector<skynet::upload_data> const & files, bool fail = false)
+	{
+		return run_with_worker(skynet_multiportal::upload, [this, filename, files, fail](worker const * w) {
+			return upload(filename, files, fail, w);
+		});
+	}
+
 	std::mutex worker_lists;
 	std::condition_variable worker_free;
 
@@ -138,11 +422,197 @@ public:
 	}
 	
 private:
+	// tries queued by race_download, each run with this thread's own connection
+	void run_attempts()
+	{
+		skynet portal;
+		std::unique_lock<std::mutex> lock(tasks_mutex);
+		while ("running") {
+			if (!attempts.size()) {
+				if (attempts_stopping) { return; }
+				attempt_queued.wait(lock);
+				continue;
+			}
+			auto attempt = std::move(attempts.front());
+			attempts.pop_front();
+			lock.unlock();
+			attempt(portal);
+			lock.lock();
+		}
+	}
+
+	// queued tasks are all run before the pool is destroyed
+	void run_tasks(skynet_multiportal::transfer_kind kind)
+	{
+		std::unique_lock<std::mutex> lock(tasks_mutex);
+		while ("running") {
+			if (!tasks[kind].size()) {
+				if (stopping) { return; }
+				task_queued[kind].wait(lock);
+				continue;
+			}
+			auto task = std::move(tasks[kind].front());
+			tasks[kind].pop_front();
+			lock.unlock();
+			task();
+			lock.lock();
+		}
+	}
+
+	// seconds a transfer of this size is expected to take on the portal, counting time lost to failures
+	// and to transfers it is already doing.  portals not yet tried are expected to be quickest,
+	// and those that have only failed are left to be tried again when exploring.
+	static double expected_time(portal_stats const & portal, size_t size)
+	{
+		if (!portal.transfers) { return portal.active; }
+		if (portal.throughput <= 0) { return std::numeric_limits<double>::max(); }
+		double time = portal.latency + size / portal.throughput;
+		return time * (1 + portal.active) / std::max(1 - portal.errors, 0.05);
+	}
+
+	// about the 95th percentile of the seconds a transfer of this size takes on the portal, taken as two deviations past what is expected.
+	// a portal not yet timed is given the quickest of those that have been.  with none timed it is infinite.
+	double hedge_seconds(skynet_multiportal::transfer_kind kind, size_t index, size_t size)
+	{
+		std::unique_lock<std::mutex> lock(stats_mutex);
+		if (!size) {
+			size = average_size[kind];
+		}
+		auto percentile = [size](portal_stats const & portal) {
+			return portal.latency + size / portal.throughput + 2 * portal.deviation;
+		};
+		if (stats[kind][index].throughput > 0) {
+			return percentile(stats[kind][index]);
+		}
+		double quickest = std::numeric_limits<double>::infinity();
+		for (auto & portal : stats[kind]) {
+			if (portal.throughput > 0) {
+				quickest = std::min(quickest, percentile(portal));
+			}
+		}
+		return quickest;
+	}
+
+	// a generous multiple of what the portal has shown, or the configured bandwidth's guess for one not yet timed.
+	// either is held to max_timeout_seconds.
+	std::chrono::milliseconds timeout(skynet_multiportal::transfer_kind kind, size_t index, size_t size, size_t maxsize)
+	{
+		double seconds = hedge_seconds(kind, index, size) * 4;
+		if (seconds > max_timeout_seconds) {
+			seconds = std::min(maxsize / bandwidth[kind], max_timeout_seconds);
+		}
+		if (seconds < min_timeout_seconds) {
+			seconds = min_timeout_seconds;
+		}
+		return std::chrono::milliseconds((unsigned long)(1000 * seconds));
+	}
+
+	void backoff(size_t tries)
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(backoff_seconds * (1 << std::min(tries - 1, size_t(5)))));
+	}
+
+	// a download tried on more than one portal at once, won by the first to succeed
+	struct download_race {
+		std::mutex mutex;
+		std::condition_variable finished;
+		size_t running = 0;
+		bool won = false;
+		skynet::response result;
+		worker const * spare = nullptr; // taken out for the second try, put back once no try is running
+		bool abandoned = false; // the downloader has stopped waiting
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::time_point::max(); // when a racer began the first try
+	};
+
+	// queues the try for a racer, so it can be left behind if another wins the race.
+	// the portal has already been taken by choose.
+	void race_download(std::shared_ptr<download_race> race, size_t index, std::string const & skylink, std::vector<std::pair<size_t, size_t>> const & ranges, std::chrono::milliseconds timeout)
+	{
+		{
+			std::lock_guard<std::mutex> lock(race->mutex);
+			++ race->running;
+		}
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex);
+			attempts.emplace_back([this, race, index, skylink, ranges, timeout](skynet & portal) {
+				auto started = std::chrono::steady_clock::now();
+				{
+					std::lock_guard<std::mutex> lock(race->mutex);
+					if (race->started == std::chrono::steady_clock::time_point::max()) {
+						race->started = started;
+						race->finished.notify_all();
+					}
+				}
+				portal.options = stats[skynet_multiportal::download][index].options;
+				skynet::response result;
+				bool succeeded = false;
+				try {
+					result = download_ranges(portal, skylink, ranges, timeout);
+					succeeded = true;
+				} catch (std::exception const & e) {
+					std::cerr << portal.options.url << ": " << e.what() << std::endl;
+				}
+				record(skynet_multiportal::download, index, started, succeeded ? result.data.size() + result.filename.size() : 0);
+				worker const * spare = nullptr;
+				{
+					std::lock_guard<std::mutex> lock(race->mutex);
+					-- race->running;
+					if (succeeded && !race->won) {
+						race->won = true;
+						race->result = std::move(result);
+					}
+					if (race->abandoned && !race->running) {
+						spare = std::exchange(race->spare, nullptr);
+					}
+					race->finished.notify_all();
+				}
+				if (spare) {
+					putworkerback(spare);
+				}
+			});
+		}
+		attempt_queued.notify_one();
+	}
+
+	// download checks there is at most one range
+	static skynet::response download_ranges(skynet & portal, std::string const & skylink, std::vector<std::pair<size_t, size_t>> const & ranges, std::chrono::milliseconds timeout)
+	{
+		if (ranges.empty()) {
+			return portal.download(skylink, {}, timeout);
+		}
+		return portal.download(skylink, {ranges[0]}, timeout);
+	}
+
 	double bandwidth[2];
-	sia::skynet_multiportal multiportal;
+
+	static constexpr size_t npos = ~size_t(0);
+	static constexpr size_t max_tries = 5;
+	static constexpr double backoff_seconds = 0.25; // before the first retry, doubling for each after
+	static constexpr size_t breaker_failures = 3; // in a row take a portal out of rotation
+	static constexpr double breaker_seconds = 15; // for the first time, doubling each time after without a success
+	static constexpr double min_timeout_seconds = 10;
+	static constexpr double max_timeout_seconds = 60 * 60 * 24;
+
+	static constexpr double smoothing = 0.2; // weight of each new transfer in the moving averages
+	static constexpr size_t explore_every = 16;
+	std::mutex stats_mutex;
+	std::vector<portal_stats> stats[2];
+	double average_size[2] = {0, 0};
+	size_t started[2] = {0, 0};
 	
 	std::vector<worker> workers[2];
 	std::vector<size_t> free[2];
+	std::deque<std::function<void(worker const *)>> waiting[2]; // transfers queued until a worker is free
+
+	std::mutex tasks_mutex;
+	std::condition_variable task_queued[2];
+	std::deque<std::function<void()>> tasks[2];
+	bool stopping = false;
+	std::vector<std::thread> runners[2];
+	std::condition_variable attempt_queued;
+	std::deque<std::function<void(skynet &)>> attempts; // download tries, queued with tasks_mutex
+	bool attempts_stopping = false;
+	std::vector<std::thread> racers;
 };
 
 }
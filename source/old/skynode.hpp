@@ -0,0 +1,311 @@
+#pragma once
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+struct skynode
+{
+	nlohmann::json identifiers;
+	nlohmann::json metadata;
+};
+
+/*
+ * Binary encoding of stream metadata nodes.  It holds the same document as the
+ * "sia-skynet-stream" 1.0.10 json, in far fewer bytes and without text parsing.
+ *
+ *	node:       "SKYN" version:u8 content:entry lookups:varint entry*
+ *	entry:      fields:u8 [spans] [bounds] [identifiers] [depth:varint]
+ *	spans:      count:u8 (kind:u8 start:u64le end:u64le)*    time is stored as the bits of a double
+ *	identifiers: count:varint (kind:u8 value)*               digests raw, other values as strings
+ *	string:     length:varint bytes
+ *
+ * Documents using anything this cannot represent are left as json by encode().
+ */
+class skynodebinary
+{
+public:
+	static constexpr uint8_t version = 1;
+
+	// returns empty if the metadata cannot be represented
+	static std::vector<uint8_t> encode(nlohmann::json const & metadata)
+	{
+		std::vector<uint8_t> result{'S', 'K', 'Y', 'N', version};
+		for (auto & field : metadata.items()) {
+			if (field.key() != "sia-skynet-stream" && field.key() != "content" && field.key() != "lookup") { return {}; }
+		}
+		if (!metadata.contains("content") || !put_entry(result, metadata["content"])) { return {}; }
+		nlohmann::json lookups = metadata.contains("lookup") ? metadata["lookup"] : nlohmann::json::array();
+		if (!lookups.is_array()) { return {}; }
+		put_varint(result, lookups.size());
+		for (auto & lookup : lookups) {
+			if (!put_entry(result, lookup)) { return {}; }
+		}
+		return result;
+	}
+
+	static bool is(uint8_t const * data, size_t size)
+	{
+		return size >= 5 && !memcmp(data, "SKYN", 4);
+	}
+
+	static nlohmann::json decode(uint8_t const * data, size_t size)
+	{
+		reader in{data, data + size};
+		in.skip(4);
+		if (in.byte() != version) {
+			throw std::runtime_error("unknown skynode version");
+		}
+		nlohmann::json result = {{"sia-skynet-stream", "1.0.10"}};
+		result["content"] = in.entry();
+		auto & lookups = result["lookup"] = nlohmann::json::array();
+		for (uint64_t count = in.varint(); count; -- count) {
+			lookups.emplace_back(in.entry());
+		}
+		return result;
+	}
+
+private:
+	enum fields : uint8_t { SPANS = 1, BOUNDS = 2, IDENTIFIERS = 4, DEPTH = 8 };
+	enum span_kind : uint8_t { TIME, BYTES, INDEX };
+	// digests, by kind, with their length in bytes.  anything else is an OTHER, stored as name and value strings.
+	enum identifier_kind : uint8_t { BLAKE2B512, SHA3_512, SHA512_256, SKYLINK, OTHER = 0xff };
+
+	static char const * span_name(uint8_t kind)
+	{
+		static char const * names[] = {"time", "bytes", "index"};
+		return kind < 3 ? names[kind] : nullptr;
+	}
+
+	static std::pair<char const *, size_t> identifier_name(uint8_t kind)
+	{
+		static std::pair<char const *, size_t> names[] = {{"blake2b512", 64}, {"sha3_512", 64}, {"sha512_256", 32}, {"skylink", 0}};
+		return kind < 4 ? names[kind] : std::pair<char const *, size_t>{nullptr, 0};
+	}
+
+	static void put_varint(std::vector<uint8_t> & out, uint64_t value)
+	{
+		while (value >= 0x80) {
+			out.push_back(uint8_t(value) | 0x80);
+			value >>= 7;
+		}
+		out.push_back(uint8_t(value));
+	}
+
+	static void put_u64(std::vector<uint8_t> & out, uint64_t value)
+	{
+		for (int shift = 0; shift < 64; shift += 8) {
+			out.push_back(uint8_t(value >> shift));
+		}
+	}
+
+	static void put_string(std::vector<uint8_t> & out, std::string const & value)
+	{
+		put_varint(out, value.size());
+		out.insert(out.end(), value.begin(), value.end());
+	}
+
+	static bool put_spans(std::vector<uint8_t> & out, nlohmann::json const & spans)
+	{
+		if (!spans.is_object() || spans.size() > 3) { return false; }
+		out.push_back(uint8_t(spans.size()));
+		for (auto & span : spans.items()) {
+			uint8_t kind = 0;
+			while (span_name(kind) && span.key() != span_name(kind)) { ++ kind; }
+			if (!span_name(kind)) { return false; }
+			out.push_back(kind);
+			for (auto & end : {"start", "end"}) {
+				if (span.value().size() != 2 || !span.value().contains(end)) { return false; }
+				auto & point = span.value()[end];
+				if (!point.is_number()) { return false; }
+				if (kind == TIME) {
+					double seconds = point;
+					uint64_t bits;
+					memcpy(&bits, &seconds, sizeof(bits));
+					put_u64(out, bits);
+				} else {
+					// positions are whole and non-negative
+					double position = point;
+					if (position < 0 || position != uint64_t(position)) { return false; }
+					put_u64(out, point.is_number_unsigned() ? point.get<uint64_t>() : uint64_t(position));
+				}
+			}
+		}
+		return true;
+	}
+
+	static int hex_value(char digit)
+	{
+		if (digit >= '0' && digit <= '9') { return digit - '0'; }
+		if (digit >= 'a' && digit <= 'f') { return digit - 'a' + 10; }
+		return -1;
+	}
+
+	static bool put_identifiers(std::vector<uint8_t> & out, nlohmann::json const & identifiers)
+	{
+		if (!identifiers.is_object()) { return false; }
+		put_varint(out, identifiers.size());
+		for (auto & identifier : identifiers.items()) {
+			if (!identifier.value().is_string()) { return false; }
+			std::string value = identifier.value();
+			uint8_t kind = 0;
+			while (identifier_name(kind).first && identifier.key() != identifier_name(kind).first) { ++ kind; }
+			size_t length = identifier_name(kind).second;
+			bool raw = length && value.size() == length * 2;
+			for (size_t i = 0; raw && i < value.size(); ++ i) {
+				raw = hex_value(value[i]) >= 0;
+			}
+			if (kind == SKYLINK) {
+				out.push_back(kind);
+				put_string(out, value);
+			} else if (raw) {
+				out.push_back(kind);
+				for (size_t i = 0; i < length; ++ i) {
+					out.push_back(uint8_t(hex_value(value[i * 2]) << 4 | hex_value(value[i * 2 + 1])));
+				}
+			} else {
+				out.push_back(OTHER);
+				put_string(out, identifier.key());
+				put_string(out, value);
+			}
+		}
+		return true;
+	}
+
+	static bool put_entry(std::vector<uint8_t> & out, nlohmann::json const & entry)
+	{
+		if (!entry.is_object()) { return false; }
+		uint8_t fields = 0;
+		for (auto & field : entry.items()) {
+			if (field.key() == "spans") { fields |= SPANS; }
+			else if (field.key() == "bounds") { fields |= BOUNDS; }
+			else if (field.key() == "identifiers") { fields |= IDENTIFIERS; }
+			else if (field.key() == "depth" && field.value().is_number_integer() && field.value() >= 0) { fields |= DEPTH; }
+			else { return false; }
+		}
+		out.push_back(fields);
+		if ((fields & SPANS) && !put_spans(out, entry["spans"])) { return false; }
+		if ((fields & BOUNDS) && !put_spans(out, entry["bounds"])) { return false; }
+		if ((fields & IDENTIFIERS) && !put_identifiers(out, entry["identifiers"])) { return false; }
+		if (fields & DEPTH) { put_varint(out, entry["depth"].get<uint64_t>()); }
+		return true;
+	}
+
+	struct reader
+	{
+		uint8_t const * data;
+		uint8_t const * end;
+
+		void need(size_t size)
+		{
+			if (size_t(end - data) < size) { throw std::runtime_error("truncated skynode"); }
+		}
+
+		void skip(size_t size)
+		{
+			need(size);
+			data += size;
+		}
+
+		uint8_t byte()
+		{
+			need(1);
+			return *data++;
+		}
+
+		uint64_t u64()
+		{
+			need(8);
+			uint64_t value = 0;
+			for (int shift = 0; shift < 64; shift += 8) {
+				value |= uint64_t(*data++) << shift;
+			}
+			return value;
+		}
+
+		uint64_t varint()
+		{
+			uint64_t value = 0;
+			for (int shift = 0; shift < 64; shift += 7) {
+				uint8_t next = byte();
+				value |= uint64_t(next & 0x7f) << shift;
+				if (!(next & 0x80)) { return value; }
+			}
+			throw std::runtime_error("bad varint in skynode");
+		}
+
+		std::string string()
+		{
+			uint64_t size = varint();
+			need(size);
+			std::string result(data, data + size);
+			data += size;
+			return result;
+		}
+
+		nlohmann::json spans()
+		{
+			nlohmann::json result = nlohmann::json::object();
+			for (uint8_t count = byte(); count; -- count) {
+				uint8_t kind = byte();
+				char const * name = span_name(kind);
+				if (!name) { throw std::runtime_error("unknown span in skynode"); }
+				auto & span = result[name];
+				for (auto & end : {"start", "end"}) {
+					uint64_t value = u64();
+					if (kind == TIME) {
+						double seconds;
+						memcpy(&seconds, &value, sizeof(seconds));
+						span[end] = seconds;
+					} else {
+						span[end] = value;
+					}
+				}
+			}
+			return result;
+		}
+
+		nlohmann::json identifiers()
+		{
+			static char const hex[] = "0123456789abcdef";
+			nlohmann::json result = nlohmann::json::object();
+			for (uint64_t count = varint(); count; -- count) {
+				uint8_t kind = byte();
+				if (kind == OTHER) {
+					auto name = string();
+					result[name] = string();
+					continue;
+				}
+				auto name = identifier_name(kind);
+				if (!name.first) { throw std::runtime_error("unknown identifier in skynode"); }
+				if (kind == SKYLINK) {
+					result[name.first] = string();
+					continue;
+				}
+				need(name.second);
+				std::string digest(name.second * 2, 0);
+				for (size_t i = 0; i < name.second; ++ i) {
+					digest[i * 2] = hex[data[i] >> 4];
+					digest[i * 2 + 1] = hex[data[i] & 0xf];
+				}
+				data += name.second;
+				result[name.first] = digest;
+			}
+			return result;
+		}
+
+		nlohmann::json entry()
+		{
+			nlohmann::json result = nlohmann::json::object();
+			uint8_t fields = byte();
+			if (fields & SPANS) { result["spans"] = spans(); }
+			if (fields & BOUNDS) { result["bounds"] = spans(); }
+			if (fields & IDENTIFIERS) { result["identifiers"] = identifiers(); }
+			if (fields & DEPTH) { result["depth"] = varint(); }
+			return result;
+		}
+	};
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "skynode.hpp"
+
+// metadata nodes shared by every skystream in the process, bounded by an estimate of the memory they take.
+// cached nodes never change, so they are used after the cache's lock is released.
+class skynodecache
+{
+public:
+	skynodecache(size_t maxbytes = 1024*1024*64)
+	: maxbytes(maxbytes),
+	  bytes(0)
+	{ }
+
+	static skynodecache & shared()
+	{
+		static skynodecache cache;
+		return cache;
+	}
+
+	std::shared_ptr<skynode const> get(std::string const & identifier)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto found = entries.find(identifier);
+		if (found == entries.end()) { return {}; }
+		lru.splice(lru.begin(), lru, found->second);
+		return found->second->node;
+	}
+
+	// if another thread cached the node first, that one is returned.
+	std::shared_ptr<skynode const> put(std::string const & identifier, skynode node)
+	{
+		// charged for the decoded node, which takes far more than its document, especially a binary one
+		size_t size = sizeof(skynode) + footprint(node.identifiers) + footprint(node.metadata);
+		std::lock_guard<std::mutex> lock(mtx);
+		auto found = entries.find(identifier);
+		if (found != entries.end()) { return found->second->node; }
+		auto result = std::make_shared<skynode const>(std::move(node));
+		lru.push_front({identifier, result, size});
+		entries[identifier] = lru.begin();
+		bytes += size;
+		shrink();
+		return result;
+	}
+
+	// pinned nodes are kept however long ago they were used, such as the roots a stream's tail refers to
+	void pin(std::string const & identifier)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		++ pins[identifier];
+	}
+
+	void unpin(std::string const & identifier)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto found = pins.find(identifier);
+		if (found == pins.end()) { return; }
+		if (! -- found->second) {
+			pins.erase(found);
+			shrink();
+		}
+	}
+
+	void resize(size_t maxbytes)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		this->maxbytes = maxbytes;
+		shrink();
+	}
+
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return bytes;
+	}
+
+	// roughly the heap memory a json value holds beyond its own sizeof: each member's node in its map or slot in its array,
+	// and the text of strings and keys
+	static size_t footprint(nlohmann::json const & value)
+	{
+		static constexpr size_t map_node = 4 * sizeof(void *) + sizeof(std::string) + sizeof(nlohmann::json);
+		size_t result = 0;
+		switch (value.type()) {
+		case nlohmann::json::value_t::object:
+			result += sizeof(nlohmann::json::object_t);
+			for (auto & member : value.items()) {
+				result += map_node + member.key().size() + footprint(member.value());
+			}
+			break;
+		case nlohmann::json::value_t::array:
+			result += sizeof(nlohmann::json::array_t);
+			for (auto & element : value) {
+				result += sizeof(nlohmann::json) + footprint(element);
+			}
+			break;
+		case nlohmann::json::value_t::string:
+			result += sizeof(std::string) + value.get_ref<std::string const &>().size();
+			break;
+		default:
+			break;
+		}
+		return result;
+	}
+
+private:
+	struct entry
+	{
+		std::string identifier;
+		std::shared_ptr<skynode const> node;
+		size_t size;
+	};
+
+	void shrink()
+	{
+		for (auto victim = lru.end(); bytes > maxbytes && victim != lru.begin();) {
+			-- victim;
+			if (pins.count(victim->identifier)) { continue; }
+			bytes -= victim->size;
+			entries.erase(victim->identifier);
+			victim = lru.erase(victim);
+		}
+	}
+
+	std::mutex mtx;
+	size_t maxbytes;
+	size_t bytes;
+	std::list<entry> lru; // most recently used first
+	std::unordered_map<std::string, std::list<entry>::iterator> entries;
+	std::unordered_map<std::string, size_t> pins;
+};
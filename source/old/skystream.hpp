@@ -1,17 +1,28 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
 #include <thread>
-#include <unordered_map>
 
 // iostreams for debug
 //#include <iostream>
 
 #include <nlohmann/json.hpp>
 
+#include <game/buffer.hpp>
+
 #include "portalpool.hpp"
 
 #include "crypto.hpp"
+#include "skytree.hpp"
+#include "skynode.hpp"
+#include "skynodecache.hpp"
 
 /*
  * The way to do random writes is to reference the previous tree as underlying data,
@@ -43,6 +54,7 @@ public:
 		tail.metadata = get_json({{way,link}});
 		tail.identifiers = cryptography.digests({&data});
 		tail.identifiers[way] = link;
+		pin_tail();
 	}
 	skystream(sia::portalpool & portalpool, nlohmann::json identifiers = {})
 	: portalpool(portalpool)
@@ -65,215 +77,314 @@ public:
 				//{"flows", {}}
 			};
 		}
+		pin_tail();
+	}
+
+	~skystream()
+	{
+		{
+			std::unique_lock<std::mutex> lock(aheadmtx);
+			readahead_chunks = 0;
+			ahead.clear();
+			aheadidle.wait(lock, [&](){ return !aheadrunning; });
+		}
+		for (auto & identifier : pinned) {
+			nodecache.unpin(identifier);
+		}
 	}
 
 	skystream(skystream const &) = default;
 	skystream(skystream &&) = default;
 
-	std::vector<uint8_t> read(std::string span, double & offset, std::string flow = "real", sia::portalpool::worker const * worker = 0)
+	// the result shares the downloaded chunk rather than copying out of it
+	// reading bytes where the last read ended starts the following chunks downloading in the background.
+	// bytes are read to the end of the chunk, or at most size of them if it is not 0, fetching only what is needed.
+	game::buffer read(std::string span, double & offset, std::string flow = "real", sia::portalpool::worker const * worker = 0, uint64_t size = 0)
 	{
-		auto metadata = this->get_node(tail, span, offset, {}, worker).metadata;
-		std::lock_guard<std::mutex> lock(methodmtx);
-		auto metadata_content = metadata["content"];
-		double content_start = metadata_content["spans"][span]["start"];
-		if (span != "bytes" && offset != content_start) {
-			throw std::runtime_error(span + " " + std::to_string(offset) + " is within block span");
+		if (span != "bytes") {
+			return read_content(locate(span, offset, worker), span, offset, worker);
 		}
-		auto data = get(metadata_content["identifiers"], worker);
-	
-		auto begin = data.begin() + offset - content_start;
-		// the goal here was, if the span is bytes, to use it as the offset in
-		// otherwise, to just return the whole chunk
-		auto end = begin;
-		if (span == "bytes") {
-			end += (uint64_t)metadata_content["bounds"]["bytes"]["end"] - content_start;
+		std::unique_lock<std::mutex> lock(aheadmtx);
+		auto found = ahead.find(offset);
+		if (found == ahead.end()) {
+			lock.unlock();
+			double start = offset;
+			auto data = read_content(locate(span, offset, worker), span, offset, worker, size);
+			lock.lock();
+			// the reader is not where it was expected, so what was read ahead is of no use
+			ahead.clear();
+			if (start == ahead_end) {
+				read_ahead(offset);
+			}
+			ahead_end = offset;
+			return data;
+		}
+		auto chunk = found->second;
+		ahead.erase(found);
+		lock.unlock();
+
+		game::buffer data;
+		try {
+			data = chunk.data.get();
+			offset = chunk.next.get();
+		} catch (std::out_of_range const &) {
+			throw;
+		} catch (std::exception const &) {
+			// a failed read ahead is retried here, where the reader can see any error
+			data = read_content(locate(span, offset, worker), span, offset, worker, size);
+		}
+		lock.lock();
+		if (size && size < data.size()) {
+			// the rest is kept for the read that continues from here
+			offset -= data.size() - size;
+			std::promise<double> next;
+			std::promise<game::buffer> rest;
+			next.set_value(chunk.next.get());
+			rest.set_value(data.slice(size));
+			ahead[offset] = {next.get_future().share(), rest.get_future().share()};
+			data = data.slice(0, size);
+			ahead_end = offset;
+			return data;
+		}
+		ahead_end = offset;
+		read_ahead(offset);
+		return data;
+	}
+
+	// reads on the portal pool's download threads once a worker is free, without waiting.
+	// the result is the data and the offset after it.  the stream must outlive the future.
+	std::future<std::pair<game::buffer, double>> read_async(std::string span, double offset, uint64_t size = 0)
+	{
+		return portalpool.run_with_worker(sia::skynet_multiportal::download, [this, span, offset, size](sia::portalpool::worker const * worker) {
+			double next = offset;
+			auto data = read(span, next, "real", worker, size);
+			return std::make_pair(data, next);
+		});
+	}
+
+	// reads bytes from offset to the end of its chunk, passing each piece to deliver as soon as it is in and verified,
+	// so the start of a large chunk can be used before its end arrives.  the next piece downloads while one is delivered.
+	// a chunk uploaded without a tree comes as one piece, verified whole.  returns the offset after the chunk.
+	double read_pieces(double offset, std::function<void(game::buffer)> const & deliver, sia::portalpool::worker const * worker = 0, uint64_t piece_size = 1024*1024*4)
+	{
+		auto metadata_content = locate("bytes", offset, worker);
+		auto identifiers = metadata_content["identifiers"];
+		double content_start = metadata_content["spans"]["bytes"]["start"];
+		uint64_t content_size = (uint64_t)metadata_content["spans"]["bytes"]["end"] - content_start;
+		uint64_t begin = offset - content_start;
+		uint64_t end = (uint64_t)metadata_content["bounds"]["bytes"]["end"] - content_start;
+		if (begin >= end) {
+			return content_start + end;
+		}
+		std::function<game::buffer(uint64_t, uint64_t, sia::portalpool::worker const *)> get_piece;
+		if (!identifiers.contains("tree")) {
+			piece_size = end;
+			get_piece = [this, identifiers, content_size](uint64_t piece_begin, uint64_t piece_end, sia::portalpool::worker const * worker) {
+				return get_range(identifiers, piece_begin, piece_end, content_size, worker);
+			};
 		} else {
-			end = data.end();
+			// the pages proving the whole range are fetched and checked once, and each piece only against them
+			auto tree = get_tree(identifiers, content_size, worker);
+			uint64_t first_page = begin / tree->leaf_size / tree->page_leaves;
+			uint64_t end_page = ((end + tree->leaf_size - 1) / tree->leaf_size + tree->page_leaves - 1) / tree->page_leaves;
+			auto digests = get_digests(identifiers, *tree, first_page, end_page, worker);
+			get_piece = [this, identifiers, tree, digests, first_page](uint64_t piece_begin, uint64_t piece_end, sia::portalpool::worker const * worker) {
+				return get_leaves(identifiers, *tree, digests, first_page, piece_begin, piece_end, worker);
+			};
+		}
+		// pieces end on multiples of piece_size, so as long as it is a multiple of the leaf size no leaf is fetched twice
+		auto piece_end = [&](uint64_t piece_begin) {
+			return std::min(end, (piece_begin / piece_size + 1) * piece_size);
+		};
+		// the next piece is fetched ahead only with a free worker, so it never holds up other transfers.
+		// without one it is fetched after the current piece is delivered.
+		auto fetch_ahead = [&](uint64_t piece_begin) -> std::future<game::buffer> {
+			auto spare = portalpool.takeworkerout(sia::skynet_multiportal::download, false);
+			if (!spare) {
+				return {};
+			}
+			return portalpool.run(sia::skynet_multiportal::download, [this, get_piece, piece_begin, piece_end = piece_end(piece_begin), spare]() {
+				game::buffer piece;
+				try {
+					piece = get_piece(piece_begin, piece_end, spare);
+				} catch (...) {
+					portalpool.putworkerback(spare);
+					throw;
+				}
+				portalpool.putworkerback(spare);
+				return piece;
+			});
+		};
+		auto piece = get_piece(begin, piece_end(begin), worker);
+		while (begin < end) {
+			std::future<game::buffer> next;
+			if (piece_end(begin) < end) {
+				next = fetch_ahead(piece_end(begin));
+			}
+			deliver(std::move(piece));
+			begin = piece_end(begin);
+			if (begin < end) {
+				piece = next.valid() ? next.get() : get_piece(begin, piece_end(begin), worker);
+			}
+		}
+		return content_start + end;
+	}
+
+	// how many chunks sequential reads keep downloading ahead.  0 disables reading ahead.
+	void readahead(size_t chunks)
+	{
+		std::lock_guard<std::mutex> lock(aheadmtx);
+		readahead_chunks = chunks;
+		if (!chunks) {
+			ahead.clear();
 		}
-		offset = metadata_content["bounds"][span]["end"];
-		return {begin, end};
 	}
 
 	std::mutex writemtx;
-	void write(std::vector<uint8_t> & data, std::string span, double offset, sia::portalpool::worker const * worker = 0)
+	// content_identifiers may be passed if data was already digested as it arrived
+	void write(std::vector<uint8_t> const & data, std::string span, double offset, sia::portalpool::worker const * worker = 0, nlohmann::json content_identifiers = {}, std::vector<uint8_t> tree = {})
 	{
 		std::lock_guard<std::mutex> writelock(writemtx);
 
-		std::unique_lock<std::mutex> lock(methodmtx);
-		seconds_t end_time = time();
-		seconds_t start_time = tail.metadata["content"]["spans"]["time"]["end"];
-		
-		node head_node;
-		nlohmann::json head_bounds;
+		// a tree over the content's leaves goes up beside it, so a range of it can be read and verified alone.
+		// its root is kept with the content's other digests.
+		if (content_identifiers.is_null()) {
+			// both are taken in one pass, a piece at a time while it is still in cache
+			game::digester digester;
+			skytree::builder leaves;
+			for (size_t hashed = 0; hashed < data.size(); hashed += hash_piece_size) {
+				size_t size = std::min(data.size() - hashed, hash_piece_size);
+				digester.update(data.data() + hashed, size);
+				leaves.update(data.data() + hashed, size);
+			}
+			content_identifiers = digester.finalize();
+			tree = leaves.finish();
+		} else if (tree.empty()) {
+			tree = skytree::encode(data.data(), data.size());
+		}
+		std::vector<uint8_t> tree_top(tree.begin(), tree.begin() + skytree::decode_header(tree.data(), tree.size()).top_size());
+		content_identifiers["tree"] = cryptography.digest({&tree_top}, skytree::md());
+
+		// only write changes the tail, and writes are serialized, so the tail is read here without methodmtx
+		// everything the tail reaches, in stream order: its lookups, with its own content among them
+		auto tail_spans = tail.metadata["content"]["spans"];
+		nlohmann::json view = nlohmann::json::array();
+		if (tail.metadata.contains("lookup")) {
+			view = tail.metadata["lookup"];
+		}
+		if (tail_spans["bytes"]["end"] > tail_spans["bytes"]["start"]) {
+			size_t position = 0;
+			while (position < view.size() && view[position]["spans"]["bytes"]["start"] < tail_spans["bytes"]["start"]) { ++ position; }
+			view.insert(view.begin() + position, nlohmann::json{
+				{"identifiers", tail.identifiers},
+				{"spans", tail_spans},
+				{"depth", 0}
+			});
+		}
+		// where each span of the stream ends
+		nlohmann::json ends;
+		for (auto & content_span : tail_spans.items()) {
+			ends[content_span.key()] = content_span.value()["end"];
+		}
+		for (auto & entry : view) {
+			for (auto & entry_span : entry["spans"].items()) {
+				if (!ends.contains(entry_span.key()) || entry_span.value()["end"] > ends[entry_span.key()]) {
+					ends[entry_span.key()] = entry_span.value()["end"];
+				}
+			}
+		}
+		unsigned long long stream_end = ends["bytes"];
+
 		unsigned long long start_bytes;
-		//unsigned long long full_size = data.size(); // let's try to implement by reusing surrounding data
-		unsigned long long index = tail.metadata["content"]["spans"]["index"]["end"];
-		if (offset == tail.metadata["content"]["spans"][span]["end"]) {
-			// append case, no head node to replace
-			start_bytes = tail.metadata["content"]["spans"]["bytes"]["end"];
-			//full_size = data.size();
+		if (span == "bytes") {
+			if (offset > stream_end) {
+				throw std::runtime_error("bytes " + std::to_string(offset) + " is past the end of the stream");
+			}
+			start_bytes = offset;
+		} else if (offset == tail_spans[span]["end"]) {
+			start_bytes = stream_end;
 		} else {
-			nlohmann::json head_node_bounds;
-			head_node = this->get_node(this->tail, span, offset, {}, worker);
-			auto head_node_content = head_node.metadata["content"];
-			double start_head = head_node_content["bounds"][span]["start"];
-			start_bytes = head_node_content["bounds"]["bytes"]["start"]; 
-			if (offset != start_head) {
-				if (span != "bytes") {
-					throw std::runtime_error(span + " " + std::to_string(offset) + " is within block span");
-				} else {
-					start_bytes = offset;
-					for (auto bound : head_node_content["bounds"].items()) {
-						if (bound.key() == "bytes") {
-							head_bounds["bytes"] = {{"start", bound.value()["start"]},{"end", start_bytes}};
-						} else {
-							head_bounds[bound.key()] = {{"start", bound.value()["start"]},{"end", bound.value()["end"]}};
-						}
-					}
-				}
+			auto bounds = this->get_node(tail, span, offset, {}, worker).metadata["content"]["bounds"];
+			if (offset != bounds[span]["start"]) {
+				throw std::runtime_error(span + " " + std::to_string(offset) + " is within block span");
 			}
-			//full_size = data.size() + offset - start_head; // full_size is the number of bytes including the beginning bits of head_node
+			start_bytes = bounds["bytes"]["start"];
 		}
-		unsigned long long end_bytes = start_bytes + data.size(); /*full_size*/
+		unsigned long long end_bytes = start_bytes + data.size();
+		// the write takes the place of what it replaces in every span, so index and time stay in byte order.
+		// only what goes past the end of the stream is new: one more index, and the time up to now.
+		auto first = position_at(tail, ends, start_bytes, worker);
+		auto last = position_at(tail, ends, end_bytes, worker);
 		nlohmann::json spans = { // these are the spans of the new write
-			{"time", {{"start", start_time},{"end", end_time}}},
+			{"time", {{"start", first["time"]},{"end", last["time"]}}},
 			{"bytes", {{"start", start_bytes},{"end", end_bytes}}},
-			{"index", {{"start", index}, {"end", index + 1}}}
+			{"index", {{"start", first["index"]}, {"end", last["index"]}}}
 		};
-		node * tail_node;
-		nlohmann::json tail_bounds;
-		try {
-			tail_node = &get_node(tail, "bytes", end_bytes, {}, worker);
-			auto tail_node_content = tail_node->metadata["content"];
-			if (end_bytes != tail_node_content["bounds"]["bytes"]["start"]) {
-				for (auto bound : tail_node_content["bounds"].items()) {
-						if (bound.key() == "bytes") {
-							tail_bounds["bytes"] = {{"start", end_bytes},{"end", bound.value()["end"]}};
-						} else {
-							tail_bounds[bound.key()] = {{"start", bound.value()["start"]},{"end", bound.value()["end"]}};
-						}
-				}
-			}
-		} catch (std::out_of_range const &) {
-			tail_node = &tail;
+		if (end_bytes >= stream_end) {
+			spans["index"]["end"] = ends["index"].get<double>() + 1;
+			spans["time"]["end"] = std::max(time(), ends["time"].get<double>());
 		}
 
-		nlohmann::json lookup_nodes = nlohmann::json::array();
-		//size_t depth = 0;
-		nlohmann::json new_lookup_node;
-		node preceding;
-		lookup_nodes.clear();
-		if (start_bytes > 0) { try {
-			preceding = this->get_node(tail, "bytes", start_bytes - 1, {}, worker); // preceding 
-			new_lookup_node = preceding.metadata["content"];
-			new_lookup_node["identifiers"] = preceding.identifiers;
-			new_lookup_node["depth"] = 0;
-			lookup_nodes = preceding.metadata["lookup"]; // everything in lookup nodes is accessible via preceding's identifiers
-			lookup_nodes.emplace_back(new_lookup_node);
-		} catch (std::out_of_range const &) { } }
-
-		// 8: we have a new way of merging lookup nodes.  we merge all adjacent pairs with equal depth, repeatedly.
-		// this means below algorithm should change to add new_lookup_node first, and then merge after adding.
-		for (size_t index = 0; index + 1 < lookup_nodes.size();) {
-			auto & current_node = lookup_nodes[index];
-			auto & next_node = lookup_nodes[index + 1];
-			if (current_node["depth"] == next_node["depth"]) {
-				auto next_spans = next_node["spans"];
-				for (auto & span : current_node["spans"].items()) {
-					auto & current_span = span.value();
-					auto & next_span = next_spans[span.key()];
-					// 10: we're changing the format to use "flows" of "real" and "logic" as below
-					// 		[this change is at the edge of checks for likely-to-finish-task.  this is known.
-					// 		 so, no more generalization until something is working and usable.]
-					// 		[ETA for completion has doubled.]
-					// 			[we have other tasks we want to do.]
-					// 				[considering undoing proposed change.]
-					// 					[okay, demand-to-make-more-general: you don't seem to have the capacity to support
-					// 					 that.  i am forcing you to not have it be more general.]
-					// 		[we will implement a test before changing further.  thank you all for the relation.]
-					// {
-					//	'sia-skynet-stream': "1.1.0_debugging",
-					// 	content: {
-					// 		identifiers: {important-stuff},
-					// 		spans: {
-					// 			{real: {time:}},
-					// 			{logic: {bytes:,index:}}
-					// 		}
-					//	},
-					//	flows: { // 'lookup' gets translated to 'flows'
-					//		real: [
-					//			{
-					//				identifiers: {important-stuff},
-					//	 			spans: {
-					//	 				{real: {time:}},
-					//	 				{logic: {bytes:,index:}}
-					//	 			}
-					//			}, ...
-					//		], // we're considering updating this to not store multiple copies of the lookup data for each order.
-					//		   // but we're noting with logic-space changes, the trees may refer to different nodes.  maybe leave for later.
-					//		   	// for streams, reuse is helpful.
-					//		logic: [
-					//			{
-					//				identifiers: {important-stuff},
-					//	 			spans: {
-					//	 				{real: {time:}},
-					//	 				{logic: {bytes:,index:}}
-					//	 			}
-					//			}, ...
-					//		]
-					//	}
-					//}
-
-					// NOTE: we need to update identifiers of lookup_nodes to point to something that contains both
-
-					auto & current_end = current_span["end"];
-					auto & next_end = next_span["end"];
-					assert (current_end == next_span["start"]);
+		// unchanged data before and after the write is referenced where it already is, truncated to what is still current.
+		// this includes the old chunks the write starts and ends inside of, so nothing around the write is uploaded again.
+		// every span is cut where the write starts and ends, so each piece keeps the index and time of the bytes it keeps.
+		auto clip = [](nlohmann::json entry, nlohmann::json const & from, nlohmann::json const & to) -> nlohmann::json
+		{
+			auto & bytes = entry["spans"]["bytes"];
+			if ((from.contains("bytes") && bytes["end"] <= from["bytes"]) || (to.contains("bytes") && bytes["start"] >= to["bytes"])) {
+				return {};
+			}
+			for (auto & entry_span : entry["spans"].items()) {
+				auto & value = entry_span.value();
+				if (from.contains(entry_span.key()) && value["start"] < from[entry_span.key()]) {
+					value["start"] = from[entry_span.key()];
+				}
+				if (to.contains(entry_span.key()) && value["end"] > to[entry_span.key()]) {
+					value["end"] = to[entry_span.key()];
+				}
+			}
+			return entry;
+		};
+		// adjacent trees of equal depth merge into one reached through the old tail, which sees both as they are.
+		// trees only merge on the same side of the write, so the old tail is never asked for what the write replaced.
+		auto merge = [&](nlohmann::json & lookup_nodes)
+		{
+			for (size_t position = 0; position + 1 < lookup_nodes.size();) {
+				auto & current_node = lookup_nodes[position];
+				auto & next_node = lookup_nodes[position + 1];
+				if (current_node["depth"] != next_node["depth"]) {
+					++ position;
+					continue;
+				}
+				for (auto & current_span : current_node["spans"].items()) {
+					if (!next_node["spans"].contains(current_span.key())) { continue; }
+					auto & current_start = current_span.value()["start"];
+					auto & current_end = current_span.value()["end"];
+					auto next_start = next_node["spans"][current_span.key()]["start"];
+					auto next_end = next_node["spans"][current_span.key()]["end"];
+					if (current_start > next_start) { current_start = next_start; }
 					if (current_end < next_end) { current_end = next_end; }
 				}
-				current_node["identifiers"] = preceding.identifiers;
+				current_node["identifiers"] = tail.identifiers;
 				current_node["depth"] = (unsigned long long)current_node["depth"] + 1;
-				lookup_nodes.erase(index + 1);
-			} else {
-				++ index;
+				lookup_nodes.erase(position + 1);
+				if (position) { -- position; }
 			}
+		};
+		nlohmann::json lookup_nodes = nlohmann::json::array();
+		nlohmann::json after_nodes = nlohmann::json::array();
+		for (auto & entry : view) {
+			auto before = clip(entry, nlohmann::json::object(), first);
+			if (!before.is_null()) { lookup_nodes.emplace_back(before); }
+			auto after = clip(entry, last, nlohmann::json::object());
+			if (!after.is_null()) { after_nodes.emplace_back(after); }
 		}
-		// 9: this is old implementation, below loop.  9: above loop is wip new implementation
-		/*
-		while (lookup_nodes.size() && lookup_nodes.back()["depth"] == depth) {
-			auto & back = lookup_nodes.back();
-			auto & back_spans = back["spans"];
-			for (auto & span : new_lookup_node["spans"].items()) {
-				auto start = back_spans[span.key()]["start"];
-				span.value()["start"] = start;
-			}
-			auto end = lookup_nodes.end();
-			-- end;
-			lookup_nodes.erase(end);
-
-			++ depth;
-		}
-		*/
-
-
-		// end: we can make a new tail metadata node that indexes everything afterward.  it can even have tree nodes if desired.
-		// 5: remaining before testing: build lookup nodes using three more sources in 1-2-3 order
-		//  1. if !head_bounds.is_null(), then add a lookup reference for head
-			// note: we can't merge this lookup node with previous because it is the only one with a link to its content.
-		if (!head_bounds.is_null()) {
-			lookup_nodes.emplace_back(nlohmann::json{
-				{"identifiers", head_node.identifiers},
-				{"spans", head_bounds},
-				{"depth", 0} // now .... will this get merged if we append to tail after this?
-						// when appending we assuming depth reduces forward, which is no longer true.
-						// we probably want to reduce depth within as well as forward.
-			});
+		merge(lookup_nodes);
+		merge(after_nodes);
+		for (auto & after : after_nodes) {
+			lookup_nodes.emplace_back(after);
 		}
 
-		//  2. if !tail_bounds.is_null(), then add a lookup reference for tail
-		//  3. reference node hierarchies until real tail to complete reference to rest of doc
-
-		auto content_identifiers = cryptography.digests({&data});
 		nlohmann::json metadata_json = {
 			{"sia-skynet-stream", "1.0.10"},
 			{"content", {
@@ -288,47 +399,100 @@ public:
 			*/
 			{"lookup", lookup_nodes}
 		};
-		std::string metadata_string = metadata_json.dump();
-		//std::cerr << metadata_string << std::endl;
+		// nodes go up in the compact binary format, or as json if it cannot hold them
+		auto metadata_binary = skynodebinary::encode(metadata_json);
+		std::string metadata_string = metadata_binary.size() ? std::string() : metadata_json.dump();
+		//std::cerr << metadata_json.dump() << std::endl;
 
-		sia::skynet::upload_data metadata_upload("metadata.json", std::vector<uint8_t>{metadata_string.begin(), metadata_string.end()}, "application/json");
+		sia::skynet::upload_data metadata_upload = metadata_binary.size()
+			? sia::skynet::upload_data("metadata", std::move(metadata_binary), "application/octet-stream")
+			: sia::skynet::upload_data("metadata.json", std::vector<uint8_t>{metadata_string.begin(), metadata_string.end()}, "application/json");
 		sia::skynet::upload_data content("content", data, "application/octet-stream");
-
-		// CHANGE 3C: let's try to reuse all surrounding data using the new 'bounds' attribute
-		// 3C: TODO: we want to insert into content from head_node if we are doing a midway-write (full_size above).  we could also split the write into two.
+		sia::skynet::upload_data tree_upload("tree", std::move(tree), "application/octet-stream");
 
 		auto metadata_identifiers = cryptography.digests({&metadata_upload.data});
 
-		lock.unlock();
-
 		std::mutex skylink_mutex;
 		std::string skylink;
-		auto ensure_upload = [&]() {
-			std::string link = portalpool.upload(metadata_identifiers["sha3_512"], {metadata_upload, content}, false, worker);
+		auto ensure_upload = [&](sia::portalpool::worker const * upload_worker) {
+			std::string link = portalpool.upload(metadata_identifiers["sha3_512"], {metadata_upload, content, tree_upload}, false, upload_worker);
 			{
 				std::lock_guard<std::mutex> lock(skylink_mutex);
 				skylink = link;
 			} 
 		};
-		auto upload1 = std::thread(ensure_upload);
-		auto upload2 = std::thread(ensure_upload);
-		upload1.join();
-		upload2.join();
-		lock.lock();
+		// each upload waits for a worker in the pool's queue rather than on one of its threads
+		std::future<void> upload1, upload2;
+		if (!worker) {
+			upload1 = portalpool.run_with_worker(sia::skynet_multiportal::upload, ensure_upload);
+			upload2 = portalpool.run_with_worker(sia::skynet_multiportal::upload, ensure_upload);
+		} else if (auto second = portalpool.takeworkerout(sia::skynet_multiportal::upload, false)) {
+			// a worker's connection is pointed at one portal at a time, so the second upload is given its own
+			upload1 = portalpool.run(sia::skynet_multiportal::upload, [&]() { ensure_upload(worker); });
+			upload2 = portalpool.run(sia::skynet_multiportal::upload, [&, second]() {
+				try {
+					ensure_upload(second);
+				} catch (...) {
+					portalpool.putworkerback(second);
+					throw;
+				}
+				portalpool.putworkerback(second);
+			});
+		} else {
+			// with none free, waiting for one could wait on workers the caller holds, so it follows the first
+			upload1 = portalpool.run(sia::skynet_multiportal::upload, [&]() { ensure_upload(worker); ensure_upload(worker); });
+		}
+		// both finish before either failure is thrown, since they refer to this frame
+		upload1.wait();
+		if (upload2.valid()) { upload2.wait(); }
+		upload1.get();
+		if (upload2.valid()) { upload2.get(); }
 		metadata_identifiers["skylink"] = skylink + "/" + metadata_upload.filename;
+		// as get_json does for fetched nodes, so the new tail's own content can be read
+		metadata_json["content"]["identifiers"]["skylink"] = skylink + "/" + content.filename;
+
+		// a manifest of the old tail is cut around the write the same way its view was
+		std::shared_ptr<manifest> next_manifest;
+		auto previous_manifest = current_manifest(false, worker);
+		if (previous_manifest) {
+			next_manifest = std::make_shared<manifest>();
+			next_manifest->tail = metadata_identifiers;
+			chunk written = {double(start_bytes), double(end_bytes), double(start_bytes), double(end_bytes), spans["index"]["start"], metadata_json["content"]["identifiers"]};
+			for (auto & chunk : previous_manifest->chunks) {
+				if (chunk.start < start_bytes) {
+					next_manifest->chunks.push_back(chunk);
+					next_manifest->chunks.back().end = std::min(chunk.end, double(start_bytes));
+				}
+			}
+			next_manifest->chunks.push_back(written);
+			for (auto & chunk : previous_manifest->chunks) {
+				if (chunk.end > end_bytes) {
+					next_manifest->chunks.push_back(chunk);
+					next_manifest->chunks.back().start = std::max(chunk.start, double(end_bytes));
+				}
+			}
+		}
 
 		// if we want to support threading we'll likely need a lock around this whole function (not just the change to tail)
 		// 	later: i've done that, but haven't integrated with old stuff to simplify
-		tail.identifiers = metadata_identifiers;
-		tail.metadata = metadata_json;
+		{
+			std::lock_guard<std::mutex> lock(methodmtx);
+			tail.identifiers = metadata_identifiers;
+			tail.metadata = metadata_json;
+			chunks_manifest = next_manifest;
+			pin_tail();
+		}
+		// chunks read ahead may have just been overwritten
+		std::lock_guard<std::mutex> lock(aheadmtx);
+		ahead.clear();
 	}
 
 	std::map<std::string,std::pair<double,double>> block_spans(std::string span, double offset, sia::portalpool::worker const * worker = 0)
 	{
-		std::lock_guard<std::mutex> lock(methodmtx);
-		auto metadata = this->get_node(tail, span, offset, {}, worker).metadata;
+		auto metadata = this->get_node(current_tail(), span, offset, {}, worker).metadata;
 		std::map<std::string,std::pair<double,double>> result;
-		for (auto & content_span : metadata["content"]["spans"].items()) {
+		// the part of the block still current
+		for (auto & content_span : metadata["content"]["bounds"].items()) {
 			auto span = content_span.key();
 			result[span].second = content_span.value()["end"];
 			result[span].first = content_span.value()["start"];
@@ -341,6 +505,35 @@ public:
 		return block_spans(span, offset, worker)[span];
 	}
 
+	// a chunk of the stream as it currently reads
+	struct chunk
+	{
+		double start, end; // the bytes of the chunk still current
+		double content_start; // where the chunk's content begins, before start if its beginning was overwritten
+		double content_end; // and where it ends, after end if its end was
+		double index;
+		nlohmann::json identifiers; // of the content
+	};
+
+	// the chunk holding byte offset.  every chunk is listed in a manifest, kept current by writes, so this usually
+	// makes no network requests.  the manifest is walked out of the whole tree the first time build is set;
+	// until then the chunk is found along the tree's path to it, which takes only a few fetches.
+	chunk chunk_at(double offset, sia::portalpool::worker const * worker = 0, bool build = false)
+	{
+		auto chunks = current_manifest(build, worker);
+		if (!chunks) {
+			auto content = this->get_node(current_tail(), "bytes", offset, {}, worker).metadata["content"];
+			auto & spans = content["spans"];
+			auto & bounds = content["bounds"];
+			return {bounds["bytes"]["start"], bounds["bytes"]["end"], spans["bytes"]["start"], spans["bytes"]["end"], spans["index"]["start"], content["identifiers"]};
+		}
+		auto found = find_chunk(*chunks, offset);
+		if (!found) {
+			throw std::out_of_range("bytes " + std::to_string(offset) + " out of range");
+		}
+		return *found;
+	}
+
 	std::map<std::string,std::pair<double,double>> spans()
 	{
 		std::lock_guard<std::mutex> lock(methodmtx);
@@ -350,12 +543,18 @@ public:
 			result[span].second = content_span.value()["end"];
 			result[span].first = content_span.value()["start"];
 		}
+		if (!tail.metadata.contains("lookup")) { return result; }
+		// after a write in the middle, lookups reach past the tail's content as well as before it
 		for (auto & lookup : tail.metadata["lookup"]) {
 			for (auto & lookup_span : lookup["spans"].items()) {
 				auto span = lookup_span.key();
-				double point = lookup_span.value()["start"];
-				if (point < result[span].first) {
-					result[span].first = point;
+				double start = lookup_span.value()["start"];
+				double end = lookup_span.value()["end"];
+				if (start < result[span].first) {
+					result[span].first = start;
+				}
+				if (end > result[span].second) {
+					result[span].second = end;
 				}
 			}
 		}
@@ -387,11 +586,11 @@ public:
 		return tail.identifiers;
 	}
 
-	std::vector<uint8_t> get(nlohmann::json identifiers, sia::portalpool::worker const * worker = 0)
+	game::buffer get(nlohmann::json identifiers, sia::portalpool::worker const * worker = 0)
 	{
 		auto skylink = identifiers["skylink"];
-		std::vector<uint8_t> result = portalpool.download(skylink, {}, 1024*1024*64, false, worker).data;
-		auto digests = cryptography.digests({&result});
+		game::buffer result = std::move(portalpool.download(skylink, {}, 1024*1024*64, false, worker).data);
+		auto digests = cryptography.digests(result.data(), result.size());
 		for (auto & digest : digests.items()) {
 			if (identifiers.contains(digest.key())) {
 				if (digest.value() != identifiers[digest.key()]) {
@@ -405,54 +604,388 @@ public:
 protected:
 	std::mutex methodmtx;
 	sia::portalpool & portalpool;
+	static constexpr size_t hash_piece_size = 1024 * 64; // hashed by every digest before the next is read
 
 private:
-	struct node
+	using node = skynode;
+
+	node current_tail()
 	{
-		nlohmann::json identifiers;
-		nlohmann::json metadata;
+		std::lock_guard<std::mutex> lock(methodmtx);
+		return tail;
+	}
+
+	// the content of the chunk holding offset, with the bounds within which it is current
+	nlohmann::json locate(std::string const & span, double offset, sia::portalpool::worker const * worker)
+	{
+		auto chunks = span == "bytes" ? current_manifest(false, worker) : nullptr;
+		if (chunks) {
+			auto found = find_chunk(*chunks, offset);
+			if (!found) {
+				throw std::out_of_range(span + " " + std::to_string(offset) + " out of range");
+			}
+			return {
+				{"identifiers", found->identifiers},
+				{"spans", {{"bytes", {{"start", found->content_start}, {"end", found->content_end}}}}},
+				{"bounds", {{"bytes", {{"start", found->start}, {"end", found->end}}}}}
+			};
+		}
+		auto metadata_content = this->get_node(current_tail(), span, offset, {}, worker).metadata["content"];
+		// other spans are read from where the part of the chunk still current starts
+		double current_start = metadata_content["bounds"][span]["start"];
+		if (span != "bytes" && offset != current_start) {
+			throw std::runtime_error(span + " " + std::to_string(offset) + " is within block span");
+		}
+		return metadata_content;
+	}
+
+	// bytes are read from offset up to the bounds, past which the chunk has been overwritten, or size of them if it is not 0.
+	// other spans return the part of the chunk still current, which is all of it unless a write replaced some.
+	// an index also takes the pieces after it that a cut left without one of their own.
+	game::buffer read_content(nlohmann::json metadata_content, std::string const & span, double & offset, sia::portalpool::worker const * worker, uint64_t size = 0)
+	{
+		double content_start = metadata_content["spans"]["bytes"]["start"];
+		uint64_t content_size = (uint64_t)metadata_content["spans"]["bytes"]["end"] - content_start;
+		if (span != "bytes") {
+			auto & bounds = metadata_content["bounds"];
+			offset = bounds[span]["end"];
+			auto data = get_range(metadata_content["identifiers"], (uint64_t)bounds["bytes"]["start"] - content_start, (uint64_t)bounds["bytes"]["end"] - content_start, content_size, worker);
+			if (span != "index") { return data; }
+			// pieces of a cut chunk left with no whole index follow the piece before them, up to where the next index starts
+			double position = bounds["bytes"]["end"];
+			double next_start;
+			try {
+				next_start = this->get_node(current_tail(), span, offset, {}, worker).metadata["content"]["bounds"]["bytes"]["start"];
+			} catch (std::out_of_range const &) {
+				next_start = this->span("bytes").second;
+			}
+			if (position >= next_start) { return data; }
+			std::vector<uint8_t> joined(data.begin(), data.end());
+			while (position < next_start) {
+				auto more = read_content(locate("bytes", position, worker), "bytes", position, worker, next_start - position);
+				joined.insert(joined.end(), more.begin(), more.end());
+			}
+			return game::buffer(std::move(joined));
+		}
+		uint64_t begin = offset - content_start;
+		uint64_t end = (uint64_t)metadata_content["bounds"]["bytes"]["end"] - content_start;
+		if (size && begin + size < end) {
+			end = begin + size;
+		}
+		offset = content_start + end;
+		return get_range(metadata_content["identifiers"], begin, end, content_size, worker);
+	}
+
+	// bytes begin to end of a chunk's content.  for less than all of it, only the leaves holding the range are fetched,
+	// with the pages of the chunk's tree that prove them.  content uploaded without a tree is fetched whole.
+	game::buffer get_range(nlohmann::json identifiers, uint64_t begin, uint64_t end, uint64_t content_size, sia::portalpool::worker const * worker = 0)
+	{
+		if ((begin == 0 && end >= content_size) || !identifiers.contains("tree")) {
+			return get(identifiers, worker).slice(begin, end - begin);
+		}
+		auto tree = get_tree(identifiers, content_size, worker);
+		uint64_t first_page = begin / tree->leaf_size / tree->page_leaves;
+		uint64_t end_page = ((end + tree->leaf_size - 1) / tree->leaf_size + tree->page_leaves - 1) / tree->page_leaves;
+		auto digests = get_digests(identifiers, *tree, first_page, end_page, worker);
+		return get_leaves(identifiers, *tree, digests, first_page, begin, end, worker);
+	}
+
+	// the leaf digests of pages first_page to end_page of a chunk's tree, checked against its top
+	game::buffer get_digests(nlohmann::json const & identifiers, skytree const & tree, uint64_t first_page, uint64_t end_page, sia::portalpool::worker const * worker)
+	{
+		auto digests_range = tree.digests_range(first_page, end_page);
+		auto digests = fetch_range(tree_link(identifiers), digests_range.first, digests_range.second, worker);
+		if (digests.size() != digests_range.second - digests_range.first || !tree.verify_pages(cryptography, first_page, digests.data(), digests.size())) {
+			throw std::runtime_error("tree digest mismatch.  identifiers=" + identifiers.dump());
+		}
+		return digests;
+	}
+
+	// bytes begin to end of a chunk's content, checked against leaf digests from get_digests starting at first_page
+	game::buffer get_leaves(nlohmann::json const & identifiers, skytree const & tree, game::buffer const & digests, uint64_t first_page, uint64_t begin, uint64_t end, sia::portalpool::worker const * worker)
+	{
+		uint64_t first_leaf = begin / tree.leaf_size;
+		uint64_t end_leaf = (end + tree.leaf_size - 1) / tree.leaf_size;
+		uint64_t fetch_begin = first_leaf * tree.leaf_size;
+		uint64_t fetch_end = std::min(end_leaf * tree.leaf_size, tree.size);
+		auto data = fetch_range(identifiers["skylink"], fetch_begin, fetch_end, worker);
+		auto leaf_digests = digests.data() + (first_leaf - first_page * tree.page_leaves) * skytree::digest_size;
+		if (data.size() != fetch_end - fetch_begin || !tree.verify_leaves(cryptography, first_leaf, leaf_digests, data.data(), data.size())) {
+			throw std::runtime_error("leaf digest mismatch.  identifiers=" + identifiers.dump() + " bytes=" + std::to_string(fetch_begin) + "-" + std::to_string(fetch_end));
+		}
+		return data.slice(begin - fetch_begin, end - begin);
+	}
+
+	// the top of a chunk's tree, checked against its root.  those of the chunks read most recently are kept.
+	std::shared_ptr<skytree const> get_tree(nlohmann::json const & identifiers, uint64_t content_size, sia::portalpool::worker const * worker)
+	{
+		std::string root = identifiers["tree"];
+		{
+			std::lock_guard<std::mutex> lock(treesmtx);
+			for (auto & cached : treecache) {
+				if (cached.first == root) { return cached.second; }
+			}
+		}
+		// the tree is assumed to have the default shape, so the top usually comes in one request
+		skytree shape;
+		shape.size = content_size;
+		auto link = tree_link(identifiers);
+		auto top = fetch_range(link, 0, shape.top_size(), worker);
+		shape = skytree::decode_header(top.data(), top.size());
+		if (top.size() != shape.top_size()) {
+			top = fetch_range(link, 0, shape.top_size(), worker);
+		}
+		if (shape.size != content_size || cryptography.digest({top.vector().get()}, skytree::md()) != root) {
+			throw std::runtime_error("tree root mismatch.  identifiers=" + identifiers.dump());
+		}
+		auto result = std::make_shared<skytree const>(skytree::decode_top(top.data(), top.size()));
+		std::lock_guard<std::mutex> lock(treesmtx);
+		treecache.emplace_front(root, result);
+		if (treecache.size() > cached_trees) {
+			treecache.pop_back();
+		}
+		return result;
+	}
+
+	// stored beside the content, as get_json assumes of metadata
+	static std::string tree_link(nlohmann::json const & identifiers)
+	{
+		std::string skylink = identifiers["skylink"];
+		skylink.resize(52);
+		return skylink + "/tree";
+	}
+
+	// bytes begin to end of an uploaded file, or fewer if it ends first
+	game::buffer fetch_range(std::string const & skylink, uint64_t begin, uint64_t end, sia::portalpool::worker const * worker)
+	{
+		game::buffer data = std::move(portalpool.download(skylink, {{begin, end - 1}}, end - begin, false, worker).data);
+		if (data.size() > end - begin) {
+			// the portal ignored the range and sent everything
+			data = data.slice(begin, end - begin);
+		}
+		return data;
+	}
+
+	struct chunk_ahead
+	{
+		std::shared_future<double> next; // known once the chunk's metadata is, so the chunk after can start
+		std::shared_future<game::buffer> data;
 	};
 
-	node & get_node(node & start, std::string span, double offset, nlohmann::json bounds = {}, sia::portalpool::worker const * worker = 0)
+	// keeps chunks downloading up to the window, after the last one already downloading or from offset if none are.
+	// called with aheadmtx held.
+	// only free download workers are used, so reading ahead never holds up other transfers.
+	void read_ahead(double offset)
+	{
+		while (ahead.size() < readahead_chunks) {
+			if (ahead.size()) {
+				auto & last = std::prev(ahead.end())->second.next;
+				if (last.wait_for(std::chrono::seconds(0)) != std::future_status::ready) { return; }
+				try {
+					offset = last.get();
+				} catch (std::exception const &) {
+					return;
+				}
+				if (ahead.count(offset)) { return; }
+			}
+			auto worker = portalpool.takeworkerout(sia::skynet_multiportal::download, false);
+			if (!worker) { return; }
+			auto next = std::make_shared<std::promise<double>>();
+			auto data = std::make_shared<std::promise<game::buffer>>();
+			ahead[offset] = {next->get_future().share(), data->get_future().share()};
+			++ aheadrunning;
+			portalpool.run(sia::skynet_multiportal::download, [this, offset, next, data, worker]() {
+				bool located = false;
+				try {
+					double chunk_offset = offset;
+					auto metadata_content = locate("bytes", chunk_offset, worker);
+					next->set_value(metadata_content["bounds"]["bytes"]["end"]);
+					located = true;
+					{
+						std::lock_guard<std::mutex> lock(aheadmtx);
+						if (ahead.size()) {
+							read_ahead(offset);
+						}
+					}
+					data->set_value(read_content(metadata_content, "bytes", chunk_offset, worker));
+				} catch (...) {
+					if (!located) {
+						next->set_exception(std::current_exception());
+					}
+					data->set_exception(std::current_exception());
+				}
+				portalpool.putworkerback(worker);
+				std::lock_guard<std::mutex> lock(aheadmtx);
+				-- aheadrunning;
+				aheadidle.notify_all();
+			});
+		}
+	}
+
+	// keeps the roots the tail refers to cached, since every lookup starts from them.  called with the tail just changed.
+	void pin_tail()
+	{
+		std::vector<std::string> roots;
+		if (tail.metadata.contains("lookup")) {
+			for (auto & lookup : tail.metadata["lookup"]) {
+				roots.push_back(lookup["identifiers"].begin().value());
+			}
+		}
+		for (auto & identifier : roots) {
+			nodecache.pin(identifier);
+		}
+		for (auto & identifier : pinned) {
+			nodecache.unpin(identifier);
+		}
+		pinned = roots;
+	}
+
+	static nlohmann::json clip_spans(nlohmann::json spans, nlohmann::json const & bounds)
+	{
+		for (auto & bound : bounds.items()) {
+			if (!spans.contains(bound.key())) { continue; }
+			auto & span = spans[bound.key()];
+			if (bound.value()["start"] > span["start"]) {
+				span["start"] = bound.value()["start"];
+			}
+			if (bound.value()["end"] < span["end"]) {
+				span["end"] = bound.value()["end"];
+			}
+		}
+		return spans;
+	}
+
+	// the node is returned by value with its bounds set, so nodes in the shared cache are never changed
+	node get_node(node const & start, std::string span, double offset, nlohmann::json bounds = {}, sia::portalpool::worker const * worker = 0)
 	{
 		auto content_spans = start.metadata["content"]["spans"];
 		auto content_span = content_spans[span];
 		if (offset >= content_span["start"] && offset < content_span["end"]) {
-			start.metadata["content"]["bounds"] = bounds.is_null() ? content_spans : bounds;
-			return start;
+			node result = start;
+			result.metadata["content"]["bounds"] = clip_spans(content_spans, bounds);
+			return result;
+		}
+		if (!start.metadata.contains("lookup")) {
+			throw std::out_of_range(span + " " + std::to_string(offset) + " out of range");
 		}
 		for (auto & lookup : start.metadata["lookup"]) {
-			auto lookup_spans = lookup["spans"];
-			for (auto & bound : bounds.items()) {
-				if (!lookup_spans.contains(bound.key())) { continue; }
-				auto bound_span = lookup_spans[bound.key()];
-				if (bound.value()["begin"] > bound_span["begin"]) {
-					bound_span["begin"] = bound.value()["begin"];
-				}
-				if (bound.value()["end"] < bound_span["end"]) {
-					bound_span["end"] = bound.value()["end"];
-				}
-			}
-			auto lookup_span = lookup["spans"][span];
+			// a lookup is only current within the bounds it was reached through
+			auto lookup_spans = clip_spans(lookup["spans"], bounds);
+			if (!lookup_spans.contains(span)) { continue; }
+			auto lookup_span = lookup_spans[span];
 			double start = lookup_span["start"];
 			double end = lookup_span["end"];
 			if (offset >= start && offset < end) {
-				auto identifiers = lookup["identifiers"];
-				std::string identifier = identifiers.begin().value();
-				if (!cache.count(identifier)) {
-					cache[identifier] = node{identifiers, get_json(identifiers, nullptr, worker)};
-				}
-				return get_node(cache[identifier], span, offset, lookup_spans);
+				return get_node(*fetch_node(lookup["identifiers"], worker), span, offset, lookup_spans, worker);
 			}
 		}
 		throw std::out_of_range(span + " " + std::to_string(offset) + " out of range");
 	}
 
-	nlohmann::json get_json(nlohmann::json identifiers, std::vector<uint8_t> * data = nullptr, sia::portalpool::worker const * worker = 0)
+	// where every span is at byte offset bytes, reached from start.  within a chunk time is spread over its bytes in proportion,
+	// and index too but rounded up to whole, so a chunk cut anywhere keeps each span in the same order as its bytes and
+	// the piece before the cut keeps its index.  ends is where the stream ends.
+	nlohmann::json position_at(node const & start, nlohmann::json const & ends, unsigned long long bytes, sia::portalpool::worker const * worker)
+	{
+		if (bytes >= (unsigned long long)ends["bytes"]) { return ends; }
+		auto content = this->get_node(start, "bytes", bytes, {}, worker).metadata["content"];
+		auto & spans = content["spans"];
+		auto & bounds = content["bounds"];
+		double bytes_start = spans["bytes"]["start"];
+		double bytes_end = spans["bytes"]["end"];
+		nlohmann::json result;
+		for (auto & content_span : spans.items()) {
+			if (bytes == bounds["bytes"]["start"]) {
+				// exactly where an earlier write cut the chunk
+				result[content_span.key()] = bounds[content_span.key()]["start"];
+				continue;
+			}
+			double span_start = content_span.value()["start"];
+			double span_end = content_span.value()["end"];
+			double position = span_start + (span_end - span_start) * ((bytes - bytes_start) / (bytes_end - bytes_start));
+			if (content_span.key() == "index") {
+				// indices stay whole; a piece after the cut may be left with none, and is read with the index before it
+				position = std::ceil(position);
+			}
+			result[content_span.key()] = position;
+		}
+		result["bytes"] = bytes;
+		return result;
+	}
+
+	std::shared_ptr<node const> fetch_node(nlohmann::json const & identifiers, sia::portalpool::worker const * worker)
+	{
+		std::string identifier = identifiers.begin().value();
+		auto cached = nodecache.get(identifier);
+		if (!cached) {
+			auto metadata = get_json(identifiers, worker);
+			cached = nodecache.put(identifier, node{identifiers, metadata});
+		}
+		return cached;
+	}
+
+	// every chunk reachable from one tail, in byte order
+	struct manifest
+	{
+		nlohmann::json tail;
+		std::vector<chunk> chunks;
+	};
+
+	// the manifest of the current tail.  if it is not known, it is walked out of the tree when build is set, and null otherwise.
+	std::shared_ptr<manifest const> current_manifest(bool build, sia::portalpool::worker const * worker)
+	{
+		node start;
+		{
+			std::lock_guard<std::mutex> lock(methodmtx);
+			if (chunks_manifest && chunks_manifest->tail == tail.identifiers) { return chunks_manifest; }
+			if (!build) { return {}; }
+			start = tail;
+		}
+		auto result = std::make_shared<manifest>();
+		result->tail = start.identifiers;
+		add_chunks(result->chunks, start, {}, worker);
+		std::sort(result->chunks.begin(), result->chunks.end(), [](chunk const & a, chunk const & b) { return a.start < b.start; });
+		std::lock_guard<std::mutex> lock(methodmtx);
+		if (tail.identifiers == result->tail) {
+			chunks_manifest = result;
+		}
+		return result;
+	}
+
+	// visits every node once.  a node's content and lookups never overlap in bytes, so neither do the chunks found.
+	void add_chunks(std::vector<chunk> & chunks, node const & start, nlohmann::json const & bounds, sia::portalpool::worker const * worker)
+	{
+		auto & content = start.metadata["content"];
+		auto content_spans = content["spans"];
+		auto current = clip_spans(content_spans, bounds)["bytes"];
+		if (current["end"] > current["start"]) {
+			chunks.push_back({current["start"], current["end"], content_spans["bytes"]["start"], content_spans["bytes"]["end"], content_spans["index"]["start"], content["identifiers"]});
+		}
+		if (!start.metadata.contains("lookup")) { return; }
+		for (auto & lookup : start.metadata["lookup"]) {
+			auto lookup_spans = clip_spans(lookup["spans"], bounds);
+			if (!lookup_spans.contains("bytes") || lookup_spans["bytes"]["end"] <= lookup_spans["bytes"]["start"]) { continue; }
+			add_chunks(chunks, *fetch_node(lookup["identifiers"], worker), lookup_spans, worker);
+		}
+	}
+
+	static chunk const * find_chunk(manifest const & chunks, double offset)
+	{
+		auto after = std::upper_bound(chunks.chunks.begin(), chunks.chunks.end(), offset, [](double offset, chunk const & chunk) {
+			return offset < chunk.start;
+		});
+		if (after == chunks.chunks.begin()) { return nullptr; }
+		-- after;
+		return offset < after->end ? &*after : nullptr;
+	}
+
+	nlohmann::json get_json(nlohmann::json identifiers, sia::portalpool::worker const * worker = 0)
 	{
 		auto data_result = get(identifiers, worker);
-		if (data) { *data = data_result; }
-		auto result = nlohmann::json::parse(data_result);
+		// older streams have json nodes
+		auto result = skynodebinary::is(data_result.data(), data_result.size())
+			? skynodebinary::decode(data_result.data(), data_result.size())
+			: nlohmann::json::parse(data_result.begin(), data_result.end());
 		// TODO improve (refactor?), hardcodes storage system and is slow due to 2 requests for each chunk
 		std::string skylink = identifiers["skylink"];
 		skylink.resize(52); skylink += "/content";
@@ -467,7 +1000,20 @@ private:
 
 	crypto cryptography;
 	node tail;
-	std::unordered_map<std::string, node> cache;
+	skynodecache & nodecache = skynodecache::shared();
+	std::vector<std::string> pinned;
+	std::shared_ptr<manifest const> chunks_manifest; // protected by methodmtx
+
+	static constexpr size_t cached_trees = 16;
+	std::mutex treesmtx;
+	std::deque<std::pair<std::string, std::shared_ptr<skytree const>>> treecache; // tops, most recently fetched first
+
+	std::mutex aheadmtx;
+	std::condition_variable aheadidle;
+	size_t readahead_chunks = 4;
+	size_t aheadrunning = 0;
+	double ahead_end = -1; // where the last read of bytes ended
+	std::map<double, chunk_ahead> ahead; // by the offset each was read from
 };
 
 /*
@@ -81,7 +81,8 @@ int main(int argc, char **argv)
 		}
 		double end = offset + length;
 		while (offset < end) {
-			auto data = stream.read(span, offset);
+			// a byte range is fetched without the rest of the chunks around it
+			auto data = stream.read(span, offset, "real", 0, span == "bytes" ? end - offset : 0);
 			std::cerr << "Downloaded " << data.size() << " bytes" << std::endl;
 			size_t suboffset = 0;
 			while (suboffset < data.size()) {
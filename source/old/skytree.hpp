@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "crypto.hpp"
+
+/*
+ * A hash tree over the fixed-size leaves of a chunk's content, uploaded beside it as "tree",
+ * so that a range of the content can be fetched and verified without the rest.
+ *
+ *	tree:  "TREE" size:u64le leaf_size:u64le page_leaves:u64le page_digest* leaf_digest*
+ *
+ * Each leaf digest is the raw sha512_256 of one leaf of the content, the last possibly short.
+ * Each page digest is that of page_leaves leaf digests in a row, the last page possibly short.
+ * The root, kept in the chunk's identifiers as "tree", is the sha512_256 of the top of the
+ * document: everything before the leaf digests.
+ *
+ * A range is proven by the top, which is small and kept, and the pages of leaf digests covering it.
+ * With the default shape, reading 4KiB of a 128MiB chunk fetches an 8KiB page beside it.
+ */
+struct skytree
+{
+	static constexpr size_t default_leaf_size = 1024 * 4;
+	static constexpr size_t default_page_leaves = 256;
+	static constexpr size_t digest_size = 32;
+	static constexpr size_t header_size = 28;
+
+	uint64_t size = 0; // of the content
+	uint64_t leaf_size = default_leaf_size;
+	uint64_t page_leaves = default_page_leaves;
+	std::vector<uint8_t> page_digests;
+
+	// sha512_256, fetched once for every tree
+	static EVP_MD const * md()
+	{
+		static EVP_MD const * const md = game::digest_md("sha512_256");
+		return md;
+	}
+
+	// builds a tree document as content arrives, with one digest context for every leaf and page
+	class builder
+	{
+	public:
+		builder(size_t leaf_size = default_leaf_size, size_t page_leaves = default_page_leaves)
+		: leaf_size(leaf_size), page_leaves(page_leaves), mdctx(game::take_mdctx())
+		{ }
+
+		builder(builder &&) = default;
+
+		~builder()
+		{
+			if (mdctx) {
+				game::put_mdctx_back(std::move(mdctx));
+			}
+		}
+
+		void update(uint8_t const * data, size_t size)
+		{
+			while (size) {
+				if (!leaf_filled) {
+					game::mdctx_init(mdctx.get(), md());
+				}
+				size_t length = std::min(size, leaf_size - leaf_filled);
+				EVP_DigestUpdate(mdctx.get(), data, length);
+				data += length;
+				size -= length;
+				leaf_filled += length;
+				content_size += length;
+				if (leaf_filled == leaf_size) {
+					finish_leaf();
+				}
+			}
+		}
+
+		// bytes passed to update since construction or the last finish
+		uint64_t size() const { return content_size; }
+
+		// returns the document for everything updated so far and starts over
+		std::vector<uint8_t> finish()
+		{
+			if (leaf_filled) {
+				finish_leaf();
+			}
+			skytree shape;
+			shape.size = content_size;
+			shape.leaf_size = leaf_size;
+			shape.page_leaves = page_leaves;
+			std::vector<uint8_t> result{'T', 'R', 'E', 'E'};
+			put_u64(result, content_size);
+			put_u64(result, leaf_size);
+			put_u64(result, page_leaves);
+			result.resize(shape.top_size());
+			result.insert(result.end(), leaf_digests.begin(), leaf_digests.end());
+			uint8_t digest[EVP_MAX_MD_SIZE];
+			unsigned length;
+			for (uint64_t page = 0; page < shape.pages(); ++ page) {
+				auto range = shape.digests_range(page, page + 1);
+				game::mdctx_init(mdctx.get(), md());
+				EVP_DigestUpdate(mdctx.get(), result.data() + range.first, range.second - range.first);
+				EVP_DigestFinal_ex(mdctx.get(), digest, &length);
+				memcpy(result.data() + header_size + page * digest_size, digest, digest_size);
+			}
+			content_size = 0;
+			leaf_digests.clear();
+			return result;
+		}
+
+	private:
+		void finish_leaf()
+		{
+			uint8_t digest[EVP_MAX_MD_SIZE];
+			unsigned length;
+			EVP_DigestFinal_ex(mdctx.get(), digest, &length);
+			leaf_digests.insert(leaf_digests.end(), digest, digest + digest_size);
+			leaf_filled = 0;
+		}
+
+		size_t leaf_size;
+		size_t page_leaves;
+		game::mdctx_ptr mdctx;
+		uint64_t content_size = 0;
+		size_t leaf_filled = 0; // of the leaf being hashed
+		std::vector<uint8_t> leaf_digests;
+	};
+
+	static std::vector<uint8_t> encode(uint8_t const * data, size_t size, size_t leaf_size = default_leaf_size, size_t page_leaves = default_page_leaves)
+	{
+		builder tree(leaf_size, page_leaves);
+		tree.update(data, size);
+		return tree.finish();
+	}
+
+	// reads the shape of a tree from the start of its document, without its digests
+	static skytree decode_header(uint8_t const * data, size_t size)
+	{
+		if (size < header_size || memcmp(data, "TREE", 4)) {
+			throw std::runtime_error("not a tree document");
+		}
+		skytree result;
+		result.size = get_u64(data + 4);
+		result.leaf_size = get_u64(data + 12);
+		result.page_leaves = get_u64(data + 20);
+		if (!result.leaf_size || !result.page_leaves) {
+			throw std::runtime_error("malformed tree document");
+		}
+		return result;
+	}
+
+	// reads the top of a document.  the rest of it may follow.
+	static skytree decode_top(uint8_t const * data, size_t size)
+	{
+		auto result = decode_header(data, size);
+		if (size < result.top_size()) {
+			throw std::runtime_error("truncated tree document");
+		}
+		result.page_digests.assign(data + header_size, data + result.top_size());
+		return result;
+	}
+
+	uint64_t leaves() const
+	{
+		return (size + leaf_size - 1) / leaf_size;
+	}
+
+	uint64_t pages() const
+	{
+		return (leaves() + page_leaves - 1) / page_leaves;
+	}
+
+	uint64_t leaf_length(uint64_t leaf) const
+	{
+		return std::min(leaf_size, size - leaf * leaf_size);
+	}
+
+	size_t top_size() const
+	{
+		return header_size + pages() * digest_size;
+	}
+
+	// where in the document the leaf digests of pages first to end are
+	std::pair<uint64_t, uint64_t> digests_range(uint64_t first_page, uint64_t end_page) const
+	{
+		uint64_t first_leaf = std::min(first_page * page_leaves, leaves());
+		uint64_t end_leaf = std::min(end_page * page_leaves, leaves());
+		return {top_size() + first_leaf * digest_size, top_size() + end_leaf * digest_size};
+	}
+
+	// whether digests are the leaf digests of whole pages from first_page
+	bool verify_pages(crypto & cryptography, uint64_t first_page, uint8_t const * digests, size_t size) const
+	{
+		uint8_t digest[EVP_MAX_MD_SIZE];
+		size_t page_size = page_leaves * digest_size;
+		uint64_t page = first_page;
+		for (size_t offset = 0; offset < size; offset += page_size, ++ page) {
+			size_t length = std::min(page_size, size - offset);
+			auto expected = digests_range(page, page + 1);
+			if (page >= pages() || length != expected.second - expected.first) { return false; }
+			cryptography.digest_raw(digests + offset, length, md(), digest);
+			if (memcmp(digest, page_digests.data() + page * digest_size, digest_size)) { return false; }
+		}
+		return true;
+	}
+
+	// whether data is whole leaves from first_leaf, given leaf digests already verified starting with that of first_leaf
+	bool verify_leaves(crypto & cryptography, uint64_t first_leaf, uint8_t const * digests, uint8_t const * data, size_t size) const
+	{
+		uint8_t digest[EVP_MAX_MD_SIZE];
+		uint64_t leaf = first_leaf;
+		for (size_t offset = 0; offset < size; offset += leaf_size, ++ leaf) {
+			size_t length = std::min<size_t>(leaf_size, size - offset);
+			if (leaf >= leaves() || length != leaf_length(leaf)) { return false; }
+			cryptography.digest_raw(data + offset, length, md(), digest);
+			if (memcmp(digest, digests + (leaf - first_leaf) * digest_size, digest_size)) { return false; }
+		}
+		return true;
+	}
+
+private:
+	static void put_u64(std::vector<uint8_t> & out, uint64_t value)
+	{
+		for (int shift = 0; shift < 64; shift += 8) {
+			out.push_back(uint8_t(value >> shift));
+		}
+	}
+
+	static uint64_t get_u64(uint8_t const * data)
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 8) {
+			value |= uint64_t(*data++) << shift;
+		}
+		return value;
+	}
+};
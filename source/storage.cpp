@@ -1,12 +1,26 @@
+#include <game/async.hpp>
 #include <game/storage.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 
 using namespace std;
 using namespace game;
 
-static unordered_set<storage *> storage_all;
+// backends register from their own static constructors, so the set must exist before any of them run
+static unordered_set<storage *> & storage_all()
+{
+	static unordered_set<storage *> all;
+	return all;
+}
 
 using process_result = storage::process_result;
 
@@ -28,48 +42,436 @@ static void process_result_propagate(process_result this_result, bool keep_store
 		if (!keep_stored) { throw process_error("data was stored"); }
 		result = process_result::STORED_AND_VERIFIED;
 		break;
+	case process_result::STORED:
+		if (!keep_stored) { throw process_error("data was stored"); }
+		// another backend having read it back still counts
+		if (process_result::STORED_AND_VERIFIED != result) {
+			result = process_result::STORED;
+		}
+		break;
 	default:
 		throw std::logic_error("corruption in enum switch case");
 	}
 }
 
-void game::storage_process(std::vector<uint8_t> & data, identifiers & what, bool keep_stored)
+static bool process_result_stored(process_result result)
 {
-	process_result result;
-	for (auto & backend : storage_all) {
-		result = backend->process(data, what, keep_stored);
-		if (result != process_result::UNPROCESSABLE && data.size()) {
-			break;
+	return result == process_result::STORED_AND_VERIFIED || result == process_result::STORED;
+}
+
+// adds identifiers a backend found to the shared set, returning whether any were new
+static bool identifiers_merge(identifiers const & found, identifiers & what)
+{
+	bool changed = false;
+	for (auto & identifier : found) {
+		auto existing = what.find(identifier.first);
+		if (existing == what.end()) {
+			what.insert(identifier);
+			changed = true;
+		} else if (existing->second != identifier.second) {
+			throw process_error("data inconsistent with identifiers");
 		}
 	}
-	if (result == process_result::UNPROCESSABLE) { throw process_error("data not processed"); }
-	process_result_propagate(result, keep_stored, result);
-	for (auto & backend : storage_all) {
-		auto this_result = backend->process(data, what, keep_stored);
-		process_result_propagate(this_result, keep_stored, result);
+	return changed;
+}
+
+void game::storage_process(buffer & data, identifiers & what, bool keep_stored)
+{
+	storage_process_batch({{&data, &what}}, keep_stored);
+}
+
+namespace {
+
+// how far each object of a batch has come
+struct progress
+{
+	process_result result = process_result::UNPROCESSABLE;
+	unordered_set<storage *> reported; // backends that have reported a result are not run again
+	bool dirty = true; // backends that could not process are run again if a later one provides data or identifiers
+};
+
+// one backend's pass over part of a batch.  each gets its own identifiers so backends may run at once.
+struct run
+{
+	run(storage * backend)
+	: backend(backend)
+	{ }
+
+	storage * backend;
+	vector<size_t> indices;
+	vector<identifiers> found;
+	vector<process_result> results;
+
+	void start(vector<storage::object> const & objects, bool keep_stored)
+	{
+		vector<storage::object> batch;
+		found.reserve(indices.size());
+		for (auto & index : indices) {
+			found.push_back(*objects[index].what);
+			batch.push_back({objects[index].data, &found.back()});
+		}
+		results = backend->process_batch(batch, keep_stored);
 	}
-	switch (result) {
-	case process_result::UNPROCESSABLE:
-		throw process_error("data not processed");
-	case process_result::VERIFIED:
-		if (keep_stored) {
-			throw process_error("data not stored");
-		} else {
-			return;
+
+	void finish(vector<storage::object> const & objects, vector<progress> & progresses, bool keep_stored)
+	{
+		for (size_t i = 0; i < indices.size(); ++ i) {
+			auto & progress = progresses[indices[i]];
+			process_result_propagate(results[i], keep_stored, progress.result);
+			if (results[i] != process_result::UNPROCESSABLE) {
+				progress.reported.insert(backend);
+				if (identifiers_merge(found[i], *objects[indices[i]].what)) {
+					progress.dirty = true;
+				}
+			}
 		}
-	case process_result::STORED_AND_VERIFIED:
+	}
+};
+
+// runs are claimed one at a time by whichever thread gets to them first: the caller, or the shared threads offered the rest.
+// the caller takes whatever they have not started, so the wait below never depends on a thread being free, even from one of them.
+// a thread that gets there after all are claimed touches nothing else, as the runs may be gone.
+struct shared_runs
+{
+	size_t count;
+	atomic<size_t> next{0};
+	mutex mtx;
+	condition_variable finished_one;
+	size_t finished = 0;
+	vector<exception_ptr> errors;
+};
+
+static void claim_runs(shared_runs & shared, vector<run> & runs, vector<storage::object> const & objects, bool keep_stored)
+{
+	for (size_t i; (i = shared.next++) < shared.count;) {
+		exception_ptr error;
+		try {
+			runs[i].start(objects, keep_stored);
+		} catch (...) {
+			error = current_exception();
+		}
+		{
+			lock_guard<mutex> lock(shared.mtx);
+			shared.errors[i] = error;
+			++ shared.finished;
+		}
+		shared.finished_one.notify_all();
+	}
+}
+
+// starts every run, the backends of a stage, on the library's shared threads, with no thread of their own
+static void start_all(vector<run> & runs, vector<storage::object> const & objects, bool keep_stored)
+{
+	if (runs.size() == 1) {
+		runs[0].start(objects, keep_stored);
 		return;
-	default:
-		throw std::logic_error("corruption in enum switch case");
+	}
+	auto shared = make_shared<shared_runs>();
+	shared->count = runs.size();
+	shared->errors.resize(runs.size());
+	for (size_t i = 1; i < runs.size(); ++ i) {
+		async_post([shared, &runs, &objects, keep_stored]() {
+			claim_runs(*shared, runs, objects, keep_stored);
+		});
+	}
+	claim_runs(*shared, runs, objects, keep_stored);
+	unique_lock<mutex> lock(shared->mtx);
+	shared->finished_one.wait(lock, [&]{ return shared->finished == shared->count; });
+	for (auto & error : shared->errors) {
+		if (error) { rethrow_exception(error); }
 	}
 }
 
-storage::storage()
+// objects already processed, found by any of their identifiers
+class recent
+{
+public:
+	recent()
+	: limit(1024 * 1024 * 64), size(0), hits(0), misses(0)
+	{ }
+
+	// fills in the data and identifiers of an object seen before, returning whether it was
+	bool find(storage::object const & object, bool keep_stored)
+	{
+		auto & what = *object.what;
+		if (!what.size()) { return false; }
+
+		lock_guard<mutex> lock(mtx);
+		auto found = entries.end();
+		for (auto & identifier : what) {
+			found = entries.find(key(identifier));
+			if (found != entries.end()) { break; }
+		}
+		if (found == entries.end() || !usable(*found->second, object, keep_stored)) {
+			++ misses;
+			return false;
+		}
+		auto & entry = *found->second;
+		lru.splice(lru.begin(), lru, found->second);
+		++ hits;
+		if (!object.data->size()) {
+			*object.data = entry.data;
+		}
+		what.insert(entry.what.begin(), entry.what.end());
+		return true;
+	}
+
+	void add(storage::object const & object, process_result result)
+	{
+		auto & data = *object.data;
+		lock_guard<mutex> lock(mtx);
+		if (!data.size() || data.size() > limit) { return; }
+
+		for (auto & identifier : *object.what) {
+			auto found = entries.find(key(identifier));
+			if (found != entries.end()) {
+				remove(found->second);
+			}
+		}
+		lru.push_front({data, *object.what, result});
+		for (auto & identifier : *object.what) {
+			entries[key(identifier)] = lru.begin();
+		}
+		size += data.size();
+		shrink();
+	}
+
+	void resize(size_t limit)
+	{
+		lock_guard<mutex> lock(mtx);
+		this->limit = limit;
+		shrink();
+	}
+
+	storage_cache_statistics stats()
+	{
+		lock_guard<mutex> lock(mtx);
+		return {hits, misses, size, lru.size()};
+	}
+
+private:
+	struct entry
+	{
+		buffer data;
+		identifiers what;
+		process_result result;
+	};
+
+	mutex mtx;
+	size_t limit;
+	size_t size;
+	size_t hits;
+	size_t misses;
+	list<entry> lru; // most recently used first
+	unordered_map<string, list<entry>::iterator> entries; // by every identifier
+
+	static string key(identifiers::value_type const & identifier)
+	{
+		return identifier.first + " " + identifier.second;
+	}
+
+	// an entry stands in for processing only if nothing about the object disagrees with it
+	static bool usable(entry const & entry, storage::object const & object, bool keep_stored)
+	{
+		if (process_result_stored(entry.result) != keep_stored) { return false; }
+		if (object.data->size() && *object.data != entry.data) { return false; }
+		for (auto & identifier : *object.what) {
+			auto known = entry.what.find(identifier.first);
+			if (known != entry.what.end() && known->second != identifier.second) { return false; }
+		}
+		return true;
+	}
+
+	void remove(list<entry>::iterator found)
+	{
+		for (auto & identifier : found->what) {
+			auto indexed = entries.find(key(identifier));
+			if (indexed != entries.end() && indexed->second == found) {
+				entries.erase(indexed);
+			}
+		}
+		size -= found->data.size();
+		lru.erase(found);
+	}
+
+	void shrink()
+	{
+		while (size > limit && lru.size()) {
+			remove(prev(lru.end()));
+		}
+	}
+};
+
+recent & recent_objects()
+{
+	static recent objects;
+	return objects;
+}
+
+}
+
+void game::storage_cache_size(size_t bytes)
+{
+	recent_objects().resize(bytes);
+}
+
+storage_cache_statistics game::storage_cache_stats()
+{
+	return recent_objects().stats();
+}
+
+// runs the backends, stage by stage, over objects not found among the recent ones
+static vector<process_result> process_batch_uncached(vector<storage::object> const & objects, bool keep_stored)
+{
+	map<storage::stage, vector<storage *>> stages;
+	for (auto & backend : storage_all()) {
+		stages[backend->order].push_back(backend);
+	}
+
+	vector<progress> progresses(objects.size());
+
+	for (bool dirty = true; dirty;) {
+		vector<bool> active(objects.size());
+		for (size_t index = 0; index < objects.size(); ++ index) {
+			active[index] = progresses[index].dirty;
+			progresses[index].dirty = false;
+		}
+		auto wanted = [&](size_t index, storage * backend) -> bool
+		{
+			auto & progress = progresses[index];
+			if (!active[index] || progress.reported.count(backend)) { return false; }
+			// an object already stored does not need storing again
+			return backend->order != storage::stage::STORE || !process_result_stored(progress.result);
+		};
+		for (auto & stage : stages) {
+			auto & backends = stage.second;
+			vector<size_t> sizes;
+			for (auto & object : objects) {
+				sizes.push_back(object.data->size());
+			}
+
+			// a backend may fill in missing data.  backends take turns with objects lacking it.
+			for (auto & backend : backends) {
+				run empty(backend);
+				for (size_t index = 0; index < objects.size(); ++ index) {
+					if (wanted(index, backend) && !objects[index].data->size()) {
+						empty.indices.push_back(index);
+					}
+				}
+				if (!empty.indices.size()) { continue; }
+				empty.start(objects, keep_stored);
+				empty.finish(objects, progresses, keep_stored);
+			}
+
+			// objects that had data are processed by every backend of the stage at once
+			vector<run> present;
+			for (auto & backend : backends) {
+				present.emplace_back(backend);
+				for (size_t index = 0; index < objects.size(); ++ index) {
+					if (wanted(index, backend) && sizes[index]) {
+						present.back().indices.push_back(index);
+					}
+				}
+				if (!present.back().indices.size()) {
+					present.pop_back();
+				}
+			}
+			start_all(present, objects, keep_stored);
+			for (auto & run : present) {
+				run.finish(objects, progresses, keep_stored);
+			}
+
+			for (size_t index = 0; index < objects.size(); ++ index) {
+				if (objects[index].data->size() != sizes[index]) {
+					progresses[index].dirty = true;
+				}
+			}
+		}
+
+		dirty = false;
+		for (auto & progress : progresses) {
+			if (progress.reported.size() == storage_all().size()) {
+				progress.dirty = false;
+			}
+			dirty = dirty || progress.dirty;
+		}
+	}
+
+	for (auto & progress : progresses) {
+		switch (progress.result) {
+		case process_result::UNPROCESSABLE:
+			throw process_error("data not processed");
+		case process_result::VERIFIED:
+			if (keep_stored) {
+				throw process_error("data not stored");
+			}
+			break;
+		case process_result::STORED_AND_VERIFIED:
+		case process_result::STORED:
+			break;
+		default:
+			throw std::logic_error("corruption in enum switch case");
+		}
+	}
+
+	vector<process_result> results;
+	for (size_t index = 0; index < objects.size(); ++ index) {
+		for (auto & backend : storage_all()) {
+			backend->processed(*objects[index].data, *objects[index].what, progresses[index].result);
+		}
+		results.push_back(progresses[index].result);
+	}
+	return results;
+}
+
+void game::storage_process_batch(std::vector<storage::object> const & objects, bool keep_stored)
+{
+	auto & recent = recent_objects();
+	vector<storage::object> pending;
+	for (auto & object : objects) {
+		if (!recent.find(object, keep_stored)) {
+			pending.push_back(object);
+		}
+	}
+	if (!pending.size()) { return; }
+
+	auto results = process_batch_uncached(pending, keep_stored);
+	for (size_t index = 0; index < pending.size(); ++ index) {
+		recent.add(pending[index], results[index]);
+	}
+}
+
+future<void> game::storage_process_async(buffer & data, identifiers & what, bool keep_stored)
+{
+	return storage_process_batch_async({{&data, &what}}, keep_stored);
+}
+
+future<void> game::storage_process_batch_async(vector<storage::object> objects, bool keep_stored)
+{
+	return async_run([objects, keep_stored]() {
+		storage_process_batch(objects, keep_stored);
+	});
+}
+
+std::vector<process_result> storage::process_batch(std::vector<object> const & objects, bool keep_stored)
+{
+	std::vector<process_result> results;
+	for (auto & object : objects) {
+		results.push_back(process(*object.data, *object.what, keep_stored));
+	}
+	return results;
+}
+
+void storage::processed(buffer const &, identifiers const &, process_result)
+{ }
+
+storage::storage(stage order)
+: order(order)
 {
-	storage_all.insert(this);
+	storage_all().insert(this);
 }
 
 storage::~storage()
 {
-	storage_all.erase(this);
+	storage_all().erase(this);
 }
@@ -1,6 +1,15 @@
+#include <game/async.hpp>
+#include <game/digests.hpp>
+#include <game/mdctx.hpp>
 #include <game/storage.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <openssl/conf.h>
@@ -11,69 +20,264 @@ static class digests_openssl : public game::storage
 {
 public:
 	digests_openssl()
+	: threaded_size(1024 * 1024 * 8)
 	{
 		ERR_load_crypto_strings();
 		OpenSSL_add_all_algorithms();
-		mdctx = EVP_MD_CTX_create();
+		for (auto & algorithm : algorithms) {
+			if (!algorithm.legacy) { continue; }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			algorithm.md = EVP_MD_fetch(NULL, algorithm.fetch_name, NULL);
+#endif
+			if (!algorithm.md) {
+				algorithm.md = algorithm.legacy();
+			}
+		}
 	}
 	~digests_openssl()
 	{
-		EVP_MD_CTX_destroy(mdctx);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		for (auto & algorithm : algorithms) {
+			EVP_MD_free(const_cast<EVP_MD *>(algorithm.md));
+		}
+#endif
 		EVP_cleanup();
 		CRYPTO_cleanup_all_ex_data();
 		ERR_free_strings();
 	}
-	process_result digest(std::initializer_list<std::vector<uint8_t> const *> data, decltype(EVP_sha3_512()) algorithm, std::string algorithm_name, game::identifiers & what)
+
+	struct algorithm
 	{
-		static thread_local std::string result;
-		static thread_local std::vector<uint8_t> bytes;
-		bytes.resize(EVP_MAX_MD_SIZE);
+		char const * name;
+		char const * fetch_name;
+		decltype(EVP_sha3_512()) (*legacy)();
+		std::atomic<bool> enabled;
+		EVP_MD const * md;
+	} algorithms[3] = {
+#ifndef OPENSSL_NO_BLAKE2
+		{"blake2b512", "BLAKE2B-512", EVP_blake2b512, {true}, nullptr},
+#else
+		{"blake2b512", "BLAKE2B-512", nullptr, {false}, nullptr},
+#endif
+		{"sha3_512", "SHA3-512", EVP_sha3_512, {true}, nullptr},
+		{"sha512_256", "SHA512-256", EVP_sha512_256, {true}, nullptr}
+	};
 
-		EVP_DigestInit_ex(mdctx, algorithm, NULL);
+	algorithm * find(std::string const & name)
+	{
+		for (auto & algorithm : algorithms) {
+			if (name == algorithm.name && algorithm.md) { return &algorithm; }
+		}
+		throw std::invalid_argument("unknown digest algorithm " + name);
+	}
+
+	std::atomic<size_t> threaded_size;
+
+	process_result digest(game::digester & digester, game::buffer const & data, game::identifiers & what)
+	{
+		if (!data.size()) { return process_result::UNPROCESSABLE; }
+
+		digester.update(data);
+		auto digests = digester.finalize();
+		// with every algorithm disabled nothing was checked
+		if (digests.empty()) { return process_result::UNPROCESSABLE; }
+		for (auto & digest : digests) {
+			auto identifier = what.find(digest.first);
+			if (identifier == what.end()) {
+				what.emplace(digest);
+			} else if (identifier->second != digest.second) {
+				return process_result::INCONSISTENT;
+			}
+		}
+		return process_result::VERIFIED;
+	}
+
+	virtual process_result process(game::buffer & data, game::identifiers & what, bool /*keep_stored*/) override
+	{
+		game::digester digester;
+		return digest(digester, data, what);
+	}
 
-		for (auto & chunk : data) {
-			EVP_DigestUpdate(mdctx, chunk->data(), chunk->size());
+	virtual std::vector<process_result> process_batch(std::vector<object> const & objects, bool /*keep_stored*/) override
+	{
+		// one digester, and so one set of contexts, serves the whole batch
+		game::digester digester;
+		std::vector<process_result> results;
+		for (auto & object : objects) {
+			results.push_back(digest(digester, *object.data, *object.what));
 		}
+		return results;
+	}
+} storage_digests_openssl;
 
-		unsigned int size;
-		EVP_DigestFinal_ex(mdctx, bytes.data(), &size);
-		bytes.resize(size);
+std::vector<std::string> game::digests_available()
+{
+	std::vector<std::string> result;
+	for (auto & algorithm : storage_digests_openssl.algorithms) {
+		if (algorithm.md) { result.emplace_back(algorithm.name); }
+	}
+	return result;
+}
 
-		result.resize(size * 2);
+void game::digests_enable(std::string const & algorithm, bool enabled)
+{
+	storage_digests_openssl.find(algorithm)->enabled = enabled;
+}
 
-		static char hex[] = {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
+bool game::digests_enabled(std::string const & algorithm)
+{
+	return storage_digests_openssl.find(algorithm)->enabled;
+}
 
-		for (unsigned int i = 0; i < size; ++ i) {
-			unsigned int j = i << 1;
-			result[j] = hex[bytes[i] >> 4];
-			result[j+1] = hex[bytes[i] & 0xf];
+EVP_MD const * game::digest_md(std::string const & algorithm)
+{
+	return storage_digests_openssl.find(algorithm)->md;
+}
+
+void game::digests_threaded_size(size_t bytes)
+{
+	storage_digests_openssl.threaded_size = bytes;
+}
+
+struct game::digester::state
+{
+	// small enough that every algorithm reads each block while it is still in cache
+	static constexpr size_t block_size = 1024 * 64;
+
+	std::vector<digests_openssl::algorithm const *> algorithms;
+	std::vector<game::mdctx_ptr> mdctxs;
+	size_t size;
+
+	state()
+	{
+		for (auto & algorithm : storage_digests_openssl.algorithms) {
+			if (algorithm.enabled) {
+				algorithms.push_back(&algorithm);
+				mdctxs.emplace_back(game::take_mdctx());
+			}
 		}
+		init();
+	}
 
-		if (what.count(algorithm_name)) {
-			if (what[algorithm_name] != result) { return process_result::INCONSISTENT; }
-		} else {
-			what[algorithm_name] = result;
+	~state()
+	{
+		for (auto & mdctx : mdctxs) {
+			game::put_mdctx_back(std::move(mdctx));
 		}
-		return process_result::VERIFIED;
 	}
 
-	virtual process_result process(std::vector<uint8_t> & data, game::identifiers & what, bool /*keep_stored*/) override
+	void init()
 	{
-		std::vector<std::pair<std::string, decltype(EVP_blake2b512())>> digests = {
-#ifndef OPENSSL_NO_BLAKE2
-			{"blake2b512", EVP_blake2b512()},
-#endif
-			{"sha3_512", EVP_sha3_512()},
-			{"sha512_256", EVP_sha512_256()}
-		};
+		for (size_t i = 0; i < algorithms.size(); ++ i) {
+			game::mdctx_init(mdctxs[i].get(), algorithms[i]->md);
+		}
+		size = 0;
+	}
 
-		for (auto & pair : digests) {
-			auto result = digest({&data}, pair.second, pair.first, what);
-			if (result == process_result::INCONSISTENT) { return result; }
+	static void update_one(EVP_MD_CTX * mdctx, uint8_t const * data, size_t size)
+	{
+		for (size_t offset = 0; offset < size; offset += block_size) {
+			EVP_DigestUpdate(mdctx, data + offset, std::min(size - offset, block_size));
 		}
-		return process_result::VERIFIED;
 	}
 
-private:
-	EVP_MD_CTX * mdctx;
-} storage_digests_openssl;
+	// algorithms are claimed one at a time by whichever thread gets to them first
+	// a thread that gets there after all are claimed touches nothing else, as the digester may be gone.
+	struct shared_update
+	{
+		size_t count;
+		std::atomic<size_t> next{0};
+		std::mutex mtx;
+		std::condition_variable finished_one;
+		size_t finished = 0;
+	};
+
+	void claim_updates(shared_update & shared, uint8_t const * data, size_t size)
+	{
+		for (size_t i; (i = shared.next++) < shared.count;) {
+			update_one(mdctxs[i].get(), data, size);
+			{
+				std::lock_guard<std::mutex> lock(shared.mtx);
+				++ shared.finished;
+			}
+			shared.finished_one.notify_all();
+		}
+	}
+
+	void update(uint8_t const * data, size_t size)
+	{
+		this->size += size;
+
+		size_t threaded_size = storage_digests_openssl.threaded_size;
+		if (mdctxs.size() > 1 && threaded_size && size >= threaded_size && std::thread::hardware_concurrency() > 1) {
+			// the other algorithms are offered to the library's shared threads.  this thread takes whatever
+			// they have not started, so the wait below never depends on a thread being free, even on one of them.
+			auto shared = std::make_shared<shared_update>();
+			shared->count = mdctxs.size();
+			for (size_t i = 1; i < mdctxs.size(); ++ i) {
+				game::async_post([this, shared, data, size]() {
+					claim_updates(*shared, data, size);
+				});
+			}
+			claim_updates(*shared, data, size);
+			std::unique_lock<std::mutex> lock(shared->mtx);
+			shared->finished_one.wait(lock, [&]{ return shared->finished == shared->count; });
+			return;
+		}
+
+		// feed each block to every algorithm before moving on, so memory is read once
+		for (size_t offset = 0; offset < size; offset += block_size) {
+			size_t block = std::min(size - offset, block_size);
+			for (auto & mdctx : mdctxs) {
+				EVP_DigestUpdate(mdctx.get(), data + offset, block);
+			}
+		}
+	}
+
+	game::identifiers finalize()
+	{
+		static char hex[] = {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
+
+		game::identifiers result;
+		uint8_t bytes[EVP_MAX_MD_SIZE];
+		for (size_t i = 0; i < algorithms.size(); ++ i) {
+			unsigned int length;
+			EVP_DigestFinal_ex(mdctxs[i].get(), bytes, &length);
+
+			auto & digest = result[algorithms[i]->name];
+			digest.resize(length * 2);
+			for (unsigned int b = 0; b < length; ++ b) {
+				unsigned int h = b << 1;
+				digest[h] = hex[bytes[b] >> 4];
+				digest[h+1] = hex[bytes[b] & 0xf];
+			}
+		}
+		init();
+		return result;
+	}
+};
+
+constexpr size_t game::digester::state::block_size;
+
+game::digester::digester()
+: _state(new state())
+{ }
+
+game::digester::digester(digester &&) = default;
+
+game::digester::~digester() = default;
+
+void game::digester::update(uint8_t const * data, size_t size)
+{
+	_state->update(data, size);
+}
+
+size_t game::digester::size() const
+{
+	return _state->size;
+}
+
+game::identifiers game::digester::finalize()
+{
+	return _state->finalize();
+}
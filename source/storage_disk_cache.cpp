@@ -0,0 +1,384 @@
+#include <game/digests.hpp>
+#include <game/disk_cache.hpp>
+#include <game/storage.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// objects are kept as files named <algorithm>-<digest>, one hard link per digest.
+// beside each is a .what file listing every identifier of the object, and whether it is stored remotely and was read back.
+// the data is only ever written after the whole pipeline has verified it.
+static class disk_cache : public game::storage
+{
+public:
+	disk_cache()
+	: game::storage(stage::LOCAL),
+	  size_limit(1024 * 1024 * 1024),
+	  loaded(false),
+	  size(0)
+	{
+		char const * cache_home = getenv("XDG_CACHE_HOME");
+		char const * home = getenv("HOME");
+		if (cache_home && *cache_home) {
+			path = std::string(cache_home) + "/libgame";
+		} else if (home && *home) {
+			path = std::string(home) + "/.cache/libgame";
+		}
+	}
+
+	virtual process_result process(game::buffer & data, game::identifiers & what, bool /*keep_stored*/) override
+	{
+		std::string filename;
+		game::identifiers known;
+		process_result result;
+		size_t expected_size;
+		bool check = false;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			auto found = find(what);
+			if (found == lru.end()) { return process_result::UNPROCESSABLE; }
+			lru.splice(lru.begin(), lru, found);
+			filename = path + "/" + found->names.front();
+			known = found->what;
+			result = found->result;
+			expected_size = found->size;
+			if (!data.size()) {
+				check = found->unconfirmed;
+				found->unconfirmed = true;
+			}
+			utimensat(AT_FDCWD, filename.c_str(), nullptr, 0);
+		}
+
+		if (!data.size()) {
+			// a damaged file is dropped and the object fetched from elsewhere.
+			// the digest stage hashes whatever is read, so the file is named by its content and only hashed here
+			// if it was read before without the pipeline confirming it, as happens when it is damaged.
+			game::buffer cached;
+			try {
+				cached = game::buffer::map(filename);
+			} catch (std::system_error const &) { }
+			if (cached.size() != expected_size) {
+				cached = {};
+			}
+			if (check && cached.size()) {
+				game::digester digester;
+				digester.update(cached);
+				for (auto & digest : digester.finalize()) {
+					auto identifier = known.find(digest.first);
+					if (identifier != known.end() && identifier->second != digest.second) {
+						cached = {};
+						break;
+					}
+				}
+			}
+			if (!cached.size()) {
+				std::lock_guard<std::mutex> lock(mtx);
+				auto found = find(known);
+				if (found != lru.end()) { remove(found); }
+				return process_result::UNPROCESSABLE;
+			}
+			data = cached;
+		}
+
+		// identifiers that disagree, such as another upload's skylink, are left to the other backends
+		for (auto & identifier : known) {
+			what.insert(identifier);
+		}
+		return result;
+	}
+
+	virtual void processed(game::buffer const & data, game::identifiers const & what, process_result result) override
+	{
+		if (!data.size() || result == process_result::UNPROCESSABLE) { return; }
+
+		std::unique_lock<std::mutex> lock(mtx);
+		if (data.size() > size_limit) { return; }
+		auto found = find(what);
+		bool added = false;
+		if (found == lru.end()) {
+			// the object is written out without the lock, so lookups and other objects do not wait on it.
+			// only linking it in under its names is done with the lock held.
+			auto names = digest_names(what);
+			if (!names.size()) { return; }
+			auto directory = path;
+			lock.unlock();
+			auto temporary = write_temporary(directory, data.data(), data.size());
+			lock.lock();
+			if (!temporary.size()) { return; }
+			// another thread may have installed it meanwhile, in which case that entry is updated below
+			found = find(what);
+			bool linked = found == lru.end() && path == directory && link_names(temporary, names, "");
+			unlink(temporary.c_str());
+			if (found == lru.end()) {
+				if (!linked) { return; }
+				lru.emplace_front(entry{names, data.size(), result, what});
+				found = lru.begin();
+				for (auto & name : names) {
+					entries[name] = found;
+				}
+				size += data.size();
+				added = true;
+			}
+		}
+		if (!added) {
+			// the pipeline has checked what was read, so it is not hashed again when next read
+			found->unconfirmed = false;
+			bool changed = rank(result) > rank(found->result);
+			if (changed) { found->result = result; }
+			for (auto & identifier : what) {
+				changed = found->what.insert(identifier).second || changed;
+			}
+			if (!changed) { return; }
+			std::vector<std::string> added_names;
+			for (auto & name : digest_names(what)) {
+				if (!entries.count(name)) { added_names.push_back(name); }
+			}
+			if (!link_names(path + "/" + found->names.front(), added_names, "")) { return; }
+			for (auto & name : added_names) {
+				found->names.push_back(name);
+				entries[name] = found;
+			}
+		}
+		auto description = describe(*found);
+		install(reinterpret_cast<uint8_t const *>(description.data()), description.size(), found->names, ".what");
+		shrink();
+	}
+
+	struct entry
+	{
+		std::vector<std::string> names;
+		size_t size;
+		process_result result; // VERIFIED, STORED or STORED_AND_VERIFIED
+		game::identifiers what;
+		bool unconfirmed = false; // read since the pipeline last checked it
+	};
+
+	// how much a result says about the object, so the most is kept
+	static int rank(process_result result)
+	{
+		switch (result) {
+		case process_result::STORED_AND_VERIFIED: return 2;
+		case process_result::STORED: return 1;
+		default: return 0;
+		}
+	}
+
+	std::mutex mtx;
+	std::string path;
+	size_t size_limit;
+	bool loaded;
+	size_t size;
+	std::list<entry> lru; // most recently used first
+	std::unordered_map<std::string, std::list<entry>::iterator> entries; // by every name
+
+	void reset()
+	{
+		loaded = false;
+		entries.clear();
+		lru.clear();
+		size = 0;
+	}
+
+	// the least recently used entries go until the cache fits
+	void shrink()
+	{
+		while (size > size_limit && lru.size()) {
+			remove(std::prev(lru.end()));
+		}
+	}
+
+private:
+	// names the files of an object would have, one per digest in its identifiers
+	static std::vector<std::string> digest_names(game::identifiers const & what)
+	{
+		auto algorithms = game::digests_available();
+		std::vector<std::string> names;
+		for (auto & identifier : what) {
+			if (std::find(algorithms.begin(), algorithms.end(), identifier.first) == algorithms.end()) { continue; }
+			auto & digest = identifier.second;
+			if (!digest.size() || digest.find_first_not_of("0123456789abcdef") != std::string::npos) { continue; }
+			names.push_back(identifier.first + "-" + digest);
+		}
+		return names;
+	}
+
+	static std::string describe(entry const & entry)
+	{
+		std::string description = entry.result == process_result::STORED_AND_VERIFIED ? "stored\n"
+			: entry.result == process_result::STORED ? "uploaded\n"
+			: "verified\n";
+		for (auto & identifier : entry.what) {
+			description += identifier.first + " " + identifier.second + "\n";
+		}
+		return description;
+	}
+
+	std::list<entry>::iterator find(game::identifiers const & what)
+	{
+		if (!load()) { return lru.end(); }
+		for (auto & name : digest_names(what)) {
+			auto found = entries.find(name);
+			if (found != entries.end()) { return found->second; }
+		}
+		return lru.end();
+	}
+
+	void remove(std::list<entry>::iterator found)
+	{
+		for (auto & name : found->names) {
+			unlink((path + "/" + name).c_str());
+			unlink((path + "/" + name + ".what").c_str());
+			entries.erase(name);
+		}
+		size -= found->size;
+		lru.erase(found);
+	}
+
+	// links source in under each name, replacing any file already there
+	bool link_names(std::string const & source, std::vector<std::string> const & names, std::string const & suffix)
+	{
+		std::string temporary = source + ".link";
+		for (auto & name : names) {
+			unlink(temporary.c_str());
+			if (link(source.c_str(), temporary.c_str()) != 0) { return false; }
+			if (rename(temporary.c_str(), (path + "/" + name + suffix).c_str()) != 0) {
+				unlink(temporary.c_str());
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// files are written under a temporary name first, so a name never refers to a partial file
+	bool install(uint8_t const * bytes, size_t size, std::vector<std::string> const & names, std::string const & suffix)
+	{
+		auto temporary = write_temporary(path, bytes, size);
+		if (!temporary.size()) { return false; }
+		bool success = link_names(temporary, names, suffix);
+		unlink(temporary.c_str());
+		return success;
+	}
+
+	// writes bytes to a new file in directory and flushes them to disk, returning its name, or empty on failure.
+	// touches nothing of the cache, so it needs no lock.
+	static std::string write_temporary(std::string const & directory, uint8_t const * bytes, size_t size)
+	{
+		std::string temporary = directory + "/.tmp-XXXXXX";
+		int fd = mkstemp(&temporary[0]);
+		if (fd < 0) { return {}; }
+		bool success = true;
+		for (size_t offset = 0; success && offset < size;) {
+			ssize_t written = write(fd, bytes + offset, size - offset);
+			success = written > 0;
+			offset += success ? written : 0;
+		}
+		success = success && fsync(fd) == 0;
+		success = close(fd) == 0 && success;
+		if (!success) {
+			unlink(temporary.c_str());
+			return {};
+		}
+		return temporary;
+	}
+
+	static bool make_directories(std::string const & path)
+	{
+		for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+			auto directory = path.substr(0, slash);
+			if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) { return false; }
+			if (slash == std::string::npos) { break; }
+		}
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+	}
+
+	// reads what is already on disk the first time the cache is used.  returns whether the cache is usable.
+	bool load()
+	{
+		if (loaded) { return true; }
+		if (!path.size() || !make_directories(path)) { return false; }
+		DIR * directory = opendir(path.c_str());
+		if (!directory) { return false; }
+
+		std::vector<std::pair<time_t, entry>> found;
+		for (struct dirent * file = readdir(directory); file; file = readdir(directory)) {
+			std::string name = file->d_name;
+			if (name.compare(0, 5, ".tmp-") == 0) {
+				unlink((path + "/" + name).c_str());
+				continue;
+			}
+			static std::string const suffix = ".what";
+			if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) { continue; }
+
+			std::ifstream description(path + "/" + name);
+			std::string line;
+			entry entry;
+			std::getline(description, line);
+			entry.result = line == "stored" ? process_result::STORED_AND_VERIFIED
+				: line == "uploaded" ? process_result::STORED
+				: process_result::VERIFIED;
+			while (std::getline(description, line)) {
+				auto space = line.find(' ');
+				if (space == std::string::npos) { continue; }
+				entry.what[line.substr(0, space)] = line.substr(space + 1);
+			}
+			entry.names = digest_names(entry.what);
+			// every name of an entry has the same .what, so each entry is read under its first name only
+			if (!entry.names.size() || name != entry.names.front() + suffix) { continue; }
+			struct stat info;
+			if (stat((path + "/" + entry.names.front()).c_str(), &info) != 0) { continue; }
+			entry.size = info.st_size;
+			found.emplace_back(info.st_mtime, std::move(entry));
+		}
+		closedir(directory);
+
+		std::sort(found.begin(), found.end(), [](std::pair<time_t, entry> const & a, std::pair<time_t, entry> const & b) {
+			return a.first > b.first;
+		});
+		for (auto & item : found) {
+			lru.emplace_back(std::move(item.second));
+			for (auto & name : lru.back().names) {
+				entries[name] = std::prev(lru.end());
+			}
+			size += lru.back().size;
+		}
+		loaded = true;
+		shrink();
+		return true;
+	}
+} storage_disk_cache;
+
+void game::disk_cache_path(std::string const & path)
+{
+	std::lock_guard<std::mutex> lock(storage_disk_cache.mtx);
+	storage_disk_cache.reset();
+	storage_disk_cache.path = path;
+}
+
+std::string game::disk_cache_path()
+{
+	std::lock_guard<std::mutex> lock(storage_disk_cache.mtx);
+	return storage_disk_cache.path;
+}
+
+void game::disk_cache_size(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(storage_disk_cache.mtx);
+	storage_disk_cache.size_limit = bytes;
+	if (storage_disk_cache.loaded) {
+		storage_disk_cache.shrink();
+	}
+}
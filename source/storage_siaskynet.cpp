@@ -1,6 +1,7 @@
 #include <game/storage.hpp>
 
 #include <cstring>
+#include <set>
 
 #include <siaskynet.hpp>
 
@@ -10,11 +11,11 @@ static class siaskynet : public game::storage
 {
 public:
 	siaskynet()
-	: portals(skynet::portals()),
-	  portal(portals.front())
+	: game::storage(stage::STORE),
+	  portals(skynet::portals())
 	{ }
 
-	virtual process_result process(std::vector<uint8_t> & data, game::identifiers & what, bool keep_stored) override
+	virtual process_result process(game::buffer & data, game::identifiers & what, bool keep_stored) override
 	{
 		// this function needs simplification.
 		// maybe start by pulling out handling mirrors to another function or class.
@@ -22,42 +23,98 @@ public:
 		// TODO: reupload after some time?
 		
 		if (what.size() == 0) { return process_result::UNPROCESSABLE; }
+		// calls may run at once on the shared threads, so each gets its own portal to point at mirrors
+		skynet portal;
+		portal.options = portals.front();
 		if (!what.count("skylink")) {
 			if (!data.size() || !keep_stored) {
 				return process_result::UNPROCESSABLE;
 			}
-			size_t count = 0;
-			std::string identifier;
-			for (auto & options : portals) {
-				portal.options = options;
-				if (count >= 2) { break; }
-				auto new_identifier = portal.upload(what.begin()->second, data);
-				if (!identifier.size()) { identifier = new_identifier; }
-				if (new_identifier != identifier) {
-					identifier = new_identifier;
-					count = 1;
-				} else {
-					++ count;
-				}
+			what["skylink"] = upload(portal, [&](){
+				return portal.upload(what.begin()->second, *data.vector());
+			});
+		}
+		return verify(portal, data, what);
+	}
+
+	virtual std::vector<process_result> process_batch(std::vector<object> const & objects, bool keep_stored) override
+	{
+		// objects that need uploading go up together, as the files of a single skylink
+		std::vector<skynet::upload_data> files;
+		std::vector<game::identifiers *> uploading;
+		std::set<std::string> filenames;
+		for (auto & object : objects) {
+			auto & what = *object.what;
+			if (!keep_stored || !object.data->size() || !what.size() || what.count("skylink")) { continue; }
+			auto & filename = what.begin()->second;
+			if (filenames.insert(filename).second) {
+				files.emplace_back(filename, *object.data->vector());
+			}
+			uploading.push_back(&what);
+		}
+		std::set<game::identifiers *> uploaded;
+		if (files.size() > 1) {
+			skynet portal;
+			auto skylink = upload(portal, [&](){
+				return portal.upload(files.front().filename, files);
+			});
+			for (auto & what : uploading) {
+				(*what)["skylink"] = skylink + "/" + what->begin()->second;
 			}
-			if (count < 2) {
-				throw game::process_error("failed to upload to sia skynet");
+			uploaded.insert(uploading.begin(), uploading.end());
+		}
+
+		// objects uploaded in the batch are not downloaded back one by one, so they are reported as stored
+		// but not verified.  objects that came with a skylink are fetched and compared.
+		std::vector<process_result> results;
+		for (auto & object : objects) {
+			if (uploaded.count(object.what)) {
+				results.push_back(process_result::STORED);
+			} else {
+				results.push_back(process(*object.data, *object.what, keep_stored));
 			}
-			what["skylink"] = identifier;
 		}
-		auto remote_data = portal.download(what["skylink"]);
+		return results;
+	}
+
+private:
+	// uploads to mirrors until two agree on the skylink, pointing portal at each in turn
+	template <typename Upload>
+	std::string upload(skynet & portal, Upload upload_one)
+	{
+		size_t count = 0;
+		std::string identifier;
+		for (auto & options : portals) {
+			portal.options = options;
+			if (count >= 2) { break; }
+			auto new_identifier = upload_one();
+			if (!identifier.size()) { identifier = new_identifier; }
+			if (new_identifier != identifier) {
+				identifier = new_identifier;
+				count = 1;
+			} else {
+				++ count;
+			}
+		}
+		if (count < 2) {
+			throw game::process_error("failed to upload to sia skynet");
+		}
+		return identifier;
+	}
+
+	process_result verify(skynet & portal, game::buffer & data, game::identifiers & what)
+	{
+		game::buffer remote_data = std::move(portal.download(what["skylink"]).data);
 		if (!data.size()) {
-			data = remote_data.data;
+			data = std::move(remote_data);
 			return process_result::STORED_AND_VERIFIED;
 		}
-		if (remote_data.data != data) {
+		if (remote_data != data) {
 			what.erase("skylink");
 			return process_result::INCONSISTENT;
 		}
 		return process_result::STORED_AND_VERIFIED;
 	}
-private:
 	
 	decltype(skynet::portals()) portals;
-	skynet portal;
 } storage_siaskynet;
@@ -37,7 +37,6 @@ int main(int argc, char **argv)
 			}
 			suboffset += size;
 		}
-		offset += data.size();
 	}
 	return 0;
 }
@@ -16,20 +16,28 @@ int main(int argc, char **argv)
 
 	std::vector<uint8_t> data;
 	data.reserve(1024 * 1024 * 16);
-	data.resize(data.capacity());
 
-	ssize_t size;
+	// blocks are digested while they are read in, so write() need not pass over them again
+	game::digester digester;
 
-	while ((size = read(0, data.data(), data.size()))) {
-		if (size < 0) {
-			perror("read");
-			std::cerr << stream.identifiers().dump(2) << std::endl;
-			return size;
+	ssize_t size = 1;
+
+	while (size) {
+		data.resize(data.capacity());
+		size_t filled = 0;
+		while (filled < data.size() && (size = read(0, data.data() + filled, data.size() - filled))) {
+			if (size < 0) {
+				perror("read");
+				std::cerr << stream.identifiers().dump(2) << std::endl;
+				return size;
+			}
+			digester.update(data.data() + filled, size);
+			filled += size;
 		}
-		data.resize(size);
-		stream.write(data, "bytes", offset);
+		if (!filled) { break; }
+		data.resize(filled);
+		stream.write(data, "bytes", offset, 0, digester.finalize());
 		offset += data.size();
-		data.resize(data.capacity());
 	}
 	std::cout << stream.identifiers().dump(2) << std::endl;
 	return 0;
@@ -0,0 +1,422 @@
+#include <game/async.hpp>
+#include <game/storage.hpp>
+#include <game/stream.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace game;
+
+// a node is stored for every chunk written.  besides the chunk's own spans and identifiers, it lists
+// the roots of a forest of perfect binary trees covering every earlier chunk, as dat does.  a root
+// refers to the last node it covers, whose own list splits the rest of the root into smaller roots.
+// so reaching any chunk from the tail fetches at most about log2 of the number of chunks nodes.
+struct stream::node
+{
+	struct range
+	{
+		game::span span;
+		offset_t start;
+		offset_t end;
+	};
+
+	struct entry
+	{
+		vector<range> spans;
+		game::identifiers what;
+		uint64_t depth;
+
+		range const * find(game::span const & span) const
+		{
+			for (auto & range : spans) {
+				if (range.span == span) { return &range; }
+			}
+			return nullptr;
+		}
+
+		bool contains(game::span const & span, offset_t offset) const
+		{
+			auto range = find(span);
+			return range && offset >= range->start && offset < range->end;
+		}
+	};
+
+	game::identifiers what; // of the node itself, once stored
+	entry content;
+	vector<entry> lookup; // in stream order
+
+	// the entry covering offset.  entries are in stream order, so they are binary searched.
+	entry const * find(game::span const & span, offset_t offset) const
+	{
+		if (content.contains(span, offset)) { return &content; }
+		auto after = upper_bound(lookup.begin(), lookup.end(), offset, [&](offset_t offset, entry const & entry) {
+			auto range = entry.find(span);
+			return range && offset < range->start;
+		});
+		if (after == lookup.begin()) { return nullptr; }
+		-- after;
+		return after->contains(span, offset) ? &*after : nullptr;
+	}
+
+	/*
+	 * node:        "GSTR" version:u8 content:entry lookups:varint entry*
+	 * entry:       spans:u8 (kind:u8 [name:string] start:varint end:varint)* identifiers:varint (name:string value:string)* depth:varint
+	 * string:      length:varint bytes
+	 */
+	static constexpr uint8_t version = 1;
+
+	buffer encode() const
+	{
+		vector<uint8_t> result{'G', 'S', 'T', 'R', version};
+		put(result, content);
+		put_varint(result, lookup.size());
+		for (auto & entry : lookup) {
+			put(result, entry);
+		}
+		return {std::move(result)};
+	}
+
+	static node decode(buffer const & data, game::identifiers const & what)
+	{
+		reader in{data.begin(), data.end()};
+		if (data.size() < 5 || memcmp(data.data(), "GSTR", 4) != 0) {
+			throw process_error("not a stream node");
+		}
+		in.data += 4;
+		if (in.byte() != version) {
+			throw process_error("unknown stream node version");
+		}
+		node result;
+		result.what = what;
+		result.content = in.next();
+		for (uint64_t count = in.varint(); count; -- count) {
+			result.lookup.emplace_back(in.next());
+		}
+		return result;
+	}
+
+	// fetches and decodes a stored node, adding any identifiers found along the way
+	static shared_ptr<node const> fetch(game::identifiers & what)
+	{
+		buffer data;
+		storage_process(data, what);
+		return make_shared<node const>(decode(data, what));
+	}
+
+private:
+	static void put_varint(vector<uint8_t> & out, uint64_t value)
+	{
+		while (value >= 0x80) {
+			out.push_back(uint8_t(value) | 0x80);
+			value >>= 7;
+		}
+		out.push_back(uint8_t(value));
+	}
+
+	static void put_string(vector<uint8_t> & out, string const & value)
+	{
+		put_varint(out, value.size());
+		out.insert(out.end(), value.begin(), value.end());
+	}
+
+	static void put(vector<uint8_t> & out, entry const & entry)
+	{
+		out.push_back(uint8_t(entry.spans.size()));
+		for (auto & range : entry.spans) {
+			out.push_back(uint8_t(range.span.kind()));
+			if (range.span.kind() == span_kind::CUSTOM) {
+				put_string(out, range.span.name());
+			}
+			put_varint(out, range.start);
+			put_varint(out, range.end);
+		}
+		put_varint(out, entry.what.size());
+		for (auto & identifier : entry.what) {
+			put_string(out, identifier.first);
+			put_string(out, identifier.second);
+		}
+		put_varint(out, entry.depth);
+	}
+
+	struct reader
+	{
+		uint8_t const * data;
+		uint8_t const * end;
+
+		uint8_t byte()
+		{
+			if (data == end) { throw process_error("truncated stream node"); }
+			return *data++;
+		}
+
+		uint64_t varint()
+		{
+			uint64_t value = 0;
+			for (int shift = 0; shift < 64; shift += 7) {
+				uint8_t next = byte();
+				value |= uint64_t(next & 0x7f) << shift;
+				if (!(next & 0x80)) { return value; }
+			}
+			throw process_error("bad varint in stream node");
+		}
+
+		string text()
+		{
+			uint64_t size = varint();
+			if (uint64_t(end - data) < size) { throw process_error("truncated stream node"); }
+			string result(data, data + size);
+			data += size;
+			return result;
+		}
+
+		node::entry next()
+		{
+			node::entry result;
+			for (uint8_t count = byte(); count; -- count) {
+				auto kind = span_kind(byte());
+				game::span span = kind == span_kind::CUSTOM ? game::span(text()) : game::span(kind);
+				offset_t start = varint();
+				result.spans.push_back({span, start, varint()});
+			}
+			for (uint64_t count = varint(); count; -- count) {
+				auto name = text();
+				result.what[name] = text();
+			}
+			result.depth = varint();
+			return result;
+		}
+	};
+};
+
+constexpr uint8_t stream::node::version;
+
+static offset_t microseconds()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+stream::stream()
+{
+	auto now = microseconds();
+	auto empty = make_shared<node>();
+	empty->content.spans = {
+		{span_kind::BYTES, 0, 0},
+		{span_kind::INDEX, 0, 0},
+		{span_kind::TIME, now, now}
+	};
+	empty->content.depth = 0;
+	tail = empty;
+}
+
+stream::stream(game::identifiers & identifiers)
+: tail(node::fetch(identifiers))
+{ }
+
+stream::~stream()
+{
+	unique_lock<mutex> lock(queuemtx);
+	queue_empty.wait(lock, [&]() { return !write_queue.size() && !reads_running; });
+}
+
+shared_ptr<stream::node const> stream::current_tail()
+{
+	lock_guard<mutex> lock(mtx);
+	return tail;
+}
+
+shared_ptr<stream::node const> stream::locate(game::span const & span, offset_t offset)
+{
+	auto current = current_tail();
+	for (;;) {
+		auto entry = current->find(span, offset);
+		if (!entry) {
+			throw out_of_range(span.name() + " " + to_string(offset) + " out of range");
+		}
+		if (entry == &current->content) { return current; }
+		auto what = entry->what;
+		current = node::fetch(what);
+	}
+}
+
+void stream::read(buffer & data, offset_t offset, game::span const & span)
+{
+	auto found = locate(span, offset);
+	auto what = found->content.what;
+	buffer chunk;
+	storage_process(chunk, what);
+	if (span.kind() == span_kind::BYTES) {
+		data = chunk.slice(offset - found->content.find(span)->start);
+	} else {
+		data = chunk;
+	}
+}
+
+void stream::write(buffer const & data, offset_t offset, game::span const & span)
+{
+	// only writing changes the tail, so it is read here without mtx
+	lock_guard<mutex> lock(writemtx);
+	auto previous = tail;
+	auto range = previous->content.find(span);
+	if (!range) {
+		throw invalid_argument("stream has no " + span.name() + " span");
+	}
+	if (offset != ~offset_t(0) && offset != range->end) {
+		throw invalid_argument("only appending to a stream is supported");
+	}
+	if (!data.size()) { return; }
+
+	auto next = make_shared<node>();
+	buffer content = data;
+	storage_process(content, next->content.what);
+
+	auto bytes = previous->content.find(span_kind::BYTES);
+	auto index = previous->content.find(span_kind::INDEX);
+	auto time = previous->content.find(span_kind::TIME);
+	next->content.spans = {
+		{span_kind::BYTES, bytes->end, bytes->end + data.size()},
+		{span_kind::INDEX, index->end, index->end + 1},
+		// at least a tick wide, so chunks written within one microsecond can still be found by time
+		{span_kind::TIME, time->end, max(microseconds(), time->end + 1)}
+	};
+	next->content.depth = 0;
+
+	// the previous chunk joins the forest, and equal trees at the end merge, like carrying in binary addition
+	next->lookup = previous->lookup;
+	if (index->end > index->start) {
+		auto preceding = previous->content;
+		preceding.what = previous->what;
+		next->lookup.push_back(preceding);
+		for (size_t size = next->lookup.size(); size >= 2 && next->lookup[size - 2].depth == next->lookup[size - 1].depth; -- size) {
+			auto & first = next->lookup[size - 2];
+			auto & second = next->lookup[size - 1];
+			for (auto & range : first.spans) {
+				auto other = second.find(range.span);
+				if (other) { range.end = other->end; }
+			}
+			// the last node of a tree splits the rest of it in its own lookup
+			first.what = previous->what;
+			++ first.depth;
+			next->lookup.pop_back();
+		}
+	}
+
+	auto encoded = next->encode();
+	storage_process(encoded, next->what);
+
+	lock_guard<mutex> tail_lock(mtx);
+	tail = next;
+}
+
+map<game::span, pair<offset_t, offset_t>> stream::chunk_spans(game::span const & span, offset_t offset)
+{
+	map<game::span, pair<offset_t, offset_t>> result;
+	for (auto & range : locate(span, offset)->content.spans) {
+		result[range.span] = {range.start, range.end};
+	}
+	return result;
+}
+
+pair<offset_t, offset_t> stream::chunk_span(game::span const & span, offset_t offset)
+{
+	return chunk_spans(span, offset)[span];
+}
+
+map<game::span, pair<offset_t, offset_t>> stream::spans()
+{
+	auto last = current_tail();
+	map<game::span, pair<offset_t, offset_t>> result;
+	for (auto & range : last->content.spans) {
+		result[range.span] = {range.start, range.end};
+	}
+	if (last->lookup.size()) {
+		for (auto & range : last->lookup.front().spans) {
+			auto found = result.find(range.span);
+			if (found != result.end() && range.start < found->second.first) {
+				found->second.first = range.start;
+			}
+		}
+	}
+	return result;
+}
+
+pair<offset_t, offset_t> stream::span(game::span const & span)
+{
+	return spans()[span];
+}
+
+map<game::span, offset_t> stream::lengths()
+{
+	map<game::span, offset_t> result;
+	for (auto & span : spans()) {
+		result[span.first] = span.second.second - span.second.first;
+	}
+	return result;
+}
+
+offset_t stream::length(game::span const & span)
+{
+	return lengths()[span];
+}
+
+future<buffer> stream::read_async(offset_t offset, game::span const & span)
+{
+	{
+		lock_guard<mutex> lock(queuemtx);
+		++ reads_running;
+	}
+	return async_run([this, offset, span]() {
+		buffer data;
+		try {
+			read(data, offset, span);
+		} catch (...) {
+			read_done();
+			throw;
+		}
+		read_done();
+		return data;
+	});
+}
+
+void stream::read_done()
+{
+	lock_guard<mutex> lock(queuemtx);
+	-- reads_running;
+	queue_empty.notify_all();
+}
+
+future<void> stream::write_async(buffer data, offset_t offset, game::span const & span)
+{
+	auto write = make_shared<packaged_task<void()>>([this, data, offset, span]() {
+		this->write(data, offset, span);
+	});
+	auto result = write->get_future();
+	lock_guard<mutex> lock(queuemtx);
+	write_queue.emplace_back([write]() { (*write)(); });
+	if (write_queue.size() == 1) {
+		async_post([this]() { write_queued(); });
+	}
+	return result;
+}
+
+// a write stays at the front of the queue while it runs, so a write queued meanwhile does not start another runner
+void stream::write_queued()
+{
+	unique_lock<mutex> lock(queuemtx);
+	while (write_queue.size()) {
+		auto write = write_queue.front();
+		lock.unlock();
+		write();
+		lock.lock();
+		write_queue.pop_front();
+	}
+	queue_empty.notify_all();
+}
+
+game::identifiers stream::identifiers()
+{
+	return current_tail()->what;
+}